@@ -0,0 +1,182 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Butterfly (hypercube) replacement for the phase 1 exchange. Needs a 
+   power-of-two number of ranks.
+
+   Round d pairs every rank with rank ^ 2^d, from the highest dimension
+   down. Within the subcube spanned by dimensions 0..d, the elements are
+   split uniformly at random between its lower and upper half, with the
+   lower half receiving exactly its final capacity. How many elements each
+   pair sends to the lower half follows a multivariate hypergeometric
+   distribution that is drawn along a binary tree over the pairs; every 
+   rank computes the draws on its own path from generators seeded by the
+   tree node, so all ranks agree on the draws without communicating. The
+   element counts the draws need (per pair, and per aligned block of 
+   pairs on the rank's path) come from recursive doubling: one exchange
+   with the partner and one with rank ^ 2^k for every lower dimension k,
+   each carrying a single count. After log2(N) rounds every rank holds
+   exactly its output block as a uniformly random subset, and phase 2 only
+   has to shuffle it locally.
+
+   Included by sanders_perm.hpp, which defines SP_DATA_TYPE.
+*/
+
+#ifndef SANDERS_BUTTERFLY_EXCHANGE_HPP
+#define SANDERS_BUTTERFLY_EXCHANGE_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <iostream>
+
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "hypergeometric.hpp"
+#include "sanders_rng.hpp"
+#include "perm_error.hpp"
+
+// stream of the draw for the tree node covering pairs [first, first+size)
+// in the given round; size 0 denotes the draw inside pair first
+inline unsigned long sp_butterfly_stream(unsigned int round, 
+					 unsigned long first,
+					 unsigned long size) {
+  return SP_BUTTERFLY_STREAMS | ((unsigned long)round << 56) | 
+    ((first & 0xfffffffUL) << 28) | (size & 0xfffffffUL);
+}
+
+inline bool sp_is_power_of_two(int N) {
+  return (N > 0) && ((N & (N-1)) == 0);
+}
+
+template<typename gen_t>
+unsigned long sp_shared_hypergeometric(const gen_t& proto, unsigned long seed,
+				       unsigned long stream,
+				       unsigned long total, unsigned long good,
+				       unsigned long draws) {
+  gen_t g(proto);
+  g.seed(seed, stream);
+  return hypergeometric(g, total, good, draws);
+}
+
+// elems - elements held by this rank, replaced by its final block
+// bounds - bounds[r] is the first position of rank r, bounds[N] the total
+// gen - this rank's generator, used to pick the elements to send
+// proto, seed - generator and seed for the draws shared between ranks
+// sent, received - number of elements moved
+template<typename perm_t, typename gen_t>
+void butterfly_exchange(std::vector<perm_t>& elems,
+			const std::vector<perm_t>& bounds,
+			gen_t& gen, const gen_t& proto, unsigned long seed,
+			int rank, int N,
+			unsigned long& sent, unsigned long& received) {
+  sent = 0;
+  received = 0;
+
+  for (int bit = N/2; bit >= 1; bit /= 2) {
+    unsigned int round = 0;
+    for (int b = bit; b > 1; b /= 2)
+      ++round;
+
+    int base = rank & ~(2*bit - 1);
+    int lower = rank & ~bit;
+    int partner = rank ^ bit;
+    unsigned long i = lower - base;
+
+    // counts of this rank and the partner, then recursive doubling over
+    // the pairs: sums[k] - elements held by the aligned block of 2^k pairs
+    // holding this pair, sibs[k] - by its sibling block
+    unsigned long mine = elems.size(), other = 0;
+    if (MPI_Sendrecv(&mine, 1, MPI_UNSIGNED_LONG, partner, 3,
+		     &other, 1, MPI_UNSIGNED_LONG, partner, 3,
+		     MPI_COMM_WORLD, MPI_STATUS_IGNORE) != 0)
+      sp_error("Butterfly exchange", "MPI_Sendrecv", 
+	       "Error exchanging counts with the partner");
+
+    std::vector<unsigned long> sums(round, 0), sibs(round, 0);
+    unsigned long block = mine + other;
+    for (unsigned int k=0; k < round; ++k) {
+      unsigned long sib = 0;
+      int q = rank ^ (1 << k);
+      if (MPI_Sendrecv(&block, 1, MPI_UNSIGNED_LONG, q, 3,
+		       &sib, 1, MPI_UNSIGNED_LONG, q, 3,
+		       MPI_COMM_WORLD, MPI_STATUS_IGNORE) != 0)
+	sp_error("Butterfly exchange", "MPI_Sendrecv", 
+		 "Error exchanging counts of the pair blocks");
+      sums[k] = block;
+      sibs[k] = sib;
+      block += sib;
+    }
+
+    // walk down the tree of pairs to the number this pair sends low; the
+    // node at level k covers pairs [lo, lo + 2^(k+1))
+    unsigned long h = bounds[base+bit] - bounds[base];
+    for (int k = (int)round - 1; k >= 0; --k) {
+      unsigned long lo = i & ~((2UL << k) - 1);
+      bool left = !(i & (1UL << k));
+      unsigned long hleft = 
+	sp_shared_hypergeometric(proto, seed,
+				 sp_butterfly_stream(round, base+lo, 2UL << k),
+				 sums[k] + sibs[k], 
+				 left ? sums[k] : sibs[k], h);
+      h = left ? hleft : (h - hleft);
+    }
+
+    // x of the lower rank's elements stay low, h - x come from the upper
+    unsigned long alow = (rank == lower) ? mine : other;
+    unsigned long aup = (rank == lower) ? other : mine;
+    unsigned long x = 
+      sp_shared_hypergeometric(proto, seed, 
+			       sp_butterfly_stream(round, base+i, 0),
+			       alow + aup, alow, h);
+
+    unsigned long nsend = (rank == lower) ? (alow - x) : (h - x);
+    unsigned long nrecv = (rank == lower) ? (h - x) : (alow - x);
+
+    // move a random subset of nsend elements to the end
+    unsigned long size = elems.size();
+    for (unsigned long k=0; k < nsend; ++k) {
+      boost::random::uniform_int_distribution<unsigned long> 
+	dist(0, size-1-k);
+      std::swap(elems[dist(gen)], elems[size-1-k]);
+    }
+
+    std::vector<perm_t> incoming(nrecv+1);
+    if (MPI_Sendrecv(elems.data() + (size-nsend), nsend, SP_DATA_TYPE, 
+		     partner, 3, &incoming[0], nrecv, SP_DATA_TYPE, 
+		     partner, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE) != 0)
+      sp_error("Butterfly exchange", "MPI_Sendrecv", 
+	       "Error exchanging elements with the partner");
+
+    elems.resize(size-nsend);
+    elems.insert(elems.end(), incoming.begin(), incoming.begin()+nrecv);
+    sent += nsend;
+    received += nrecv;
+  }
+}
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+
+// Measures the phase 2 kernels on this machine and writes the table that
+// SP_PHASE2_AUTO dispatches with.
+//
+//   calibrate [table file] [largest buffer, elements]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "local_shuffle.hpp"
+#include "sanders_rng.hpp"
+#include "perm_error.hpp"
+
+// repetitions per measurement, the fastest counts
+#define CALIBRATE_REPEATS 3
+
+typedef unsigned long int perm_t;
+
+double time_kernel(sp_phase2_engine e, std::vector<perm_t>& buf,
+		   unsigned int threads, sp_mt19937_rng& gen) {
+  double best = -1;
+  for (int k=0; k < CALIBRATE_REPEATS; ++k) {
+    std::chrono::steady_clock::time_point start = 
+      std::chrono::steady_clock::now();
+    if (e == SP_DART_THROWING)
+      dart_shuffle(&buf[0], buf.size(), threads, gen, SP_DEFAULT_SEED, k);
+    else if (e == SP_BUCKET_SHUFFLE)
+      bucket_shuffle(&buf[0], buf.size(), gen);
+    else
+      fisher_yates_shuffle(&buf[0], buf.size(), gen);
+    double elapsed = std::chrono::duration<double>
+      (std::chrono::steady_clock::now() - start).count();
+    if ((best < 0) || (elapsed < best))
+      best = elapsed;
+  }
+  return best;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::string path = SP_PHASE2_CALIBRATION_FILE;
+  if (argc > 1)
+    path = argv[1];
+
+  unsigned long int largest = 1UL << 26;
+  if (argc > 2)
+    largest = std::strtoul(argv[2], NULL, 10);
+
+  unsigned int maxthreads = std::thread::hardware_concurrency();
+  if (maxthreads == 0)
+    maxthreads = 1;
+
+  sp_mt19937_rng gen;
+  gen.seed(SP_DEFAULT_SEED, 0);
+  sp_phase2_calibration table;
+  sp_phase2_engine engines[] = { SP_FISHER_YATES, SP_BUCKET_SHUFFLE, 
+				 SP_DART_THROWING };
+
+  for (unsigned long int n = 1UL << 10; n <= largest; n *= 4) {
+    std::vector<perm_t> buf(n);
+    for (unsigned long int i=0; i < n; ++i)
+      buf[i] = i;
+
+    // Fisher-Yates and the bucket shuffle do not depend on threads
+    double single[2];
+    for (int k=0; k < 2; ++k)
+      single[k] = time_kernel(engines[k], buf, 1, gen);
+
+    for (unsigned int t=1; t <= maxthreads; t *= 2) {
+      double times[3] = { single[0], single[1], 
+			  time_kernel(SP_DART_THROWING, buf, t, gen) };
+      int best = 0;
+      for (int k=1; k < 3; ++k)
+	if (times[k] < times[best])
+	  best = k;
+
+      table.add(t, n, engines[best]);
+      std::cout << "threads " << t << ", elements " << n << " :";
+      for (int k=0; k < 3; ++k)
+	std::cout << " " << sp_phase2_engine_name(engines[k]) << " " 
+		  << times[k] << " s";
+      std::cout << " -> " << sp_phase2_engine_name(engines[best]) 
+		<< std::endl;
+    }
+  }
+
+  if (!table.save(path)) {
+    sp_error("Calibrate", "-", "Cannot write " + path);
+    return 1;
+  }
+  std::cout << "Calibration table written to " << path << std::endl;
+  return 0;
+}
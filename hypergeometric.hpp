@@ -0,0 +1,123 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Hypergeometric sampling used to decide how many elements of a block
+   fall into a group when a set is split into groups of exact sizes.
+   Sampling is done by inversion starting at the mode, which costs
+   O(standard deviation) steps and works for populations beyond 2^32.
+*/
+
+#ifndef SANDERS_HYPERGEOMETRIC_HPP
+#define SANDERS_HYPERGEOMETRIC_HPP
+
+#include <cmath>
+#include <vector>
+
+#include <boost/random/uniform_01.hpp>
+
+// Number of successes when `draws` items are taken without replacement
+// from `total` items of which `good` are successes.
+template<typename gen_t>
+unsigned long hypergeometric(gen_t& gen, unsigned long total,
+			     unsigned long good, unsigned long draws) {
+  unsigned long bad = total - good;
+  unsigned long lo = (draws > bad) ? (draws - bad) : 0;
+  unsigned long hi = (draws < good) ? draws : good;
+
+  if (lo == hi)
+    return lo;
+
+  long double ltotal = total, lgood = good, ldraws = draws;
+  unsigned long mode = (unsigned long)
+    std::floor((ldraws + 1) * (lgood + 1) / (ltotal + 2));
+  if (mode < lo) mode = lo;
+  if (mode > hi) mode = hi;
+
+  // pmf at the mode, computed in log space
+  long double lp = std::lgamma(lgood + 1) - std::lgamma((long double)mode + 1)
+    - std::lgamma(lgood - mode + 1)
+    + std::lgamma((long double)bad + 1) 
+    - std::lgamma(ldraws - mode + 1)
+    - std::lgamma((long double)bad - (draws - mode) + 1)
+    - std::lgamma(ltotal + 1) + std::lgamma(ldraws + 1)
+    + std::lgamma(ltotal - ldraws + 1);
+  long double pmode = std::exp(lp);
+
+  boost::random::uniform_01<long double> uni;
+  long double u = uni(gen) - pmode;
+  if (u <= 0)
+    return mode;
+
+  // walk outwards from the mode, alternating up and down
+  unsigned long up = mode, down = mode;
+  long double pup = pmode, pdown = pmode;
+  long double lbad = bad;
+  while ((up < hi) || (down > lo)) {
+    if (up < hi) {
+      long double k = up;
+      pup *= ((lgood - k) * (ldraws - k)) / ((k + 1) * (lbad - ldraws + k + 1));
+      ++up;
+      u -= pup;
+      if (u <= 0)
+	return up;
+    }
+
+    if (down > lo) {
+      long double k = down;
+      pdown *= (k * (lbad - ldraws + k)) / ((lgood - k + 1) * (ldraws - k + 1));
+      --down;
+      u -= pdown;
+      if (u <= 0)
+	return down;
+    }
+  }
+
+  // only reachable through rounding in the tail
+  return mode;
+}
+
+// Splits `draws` items drawn without replacement across groups with
+// capacities `caps`; out[i] receives the number drawn from group i.
+template<typename gen_t, typename count_t>
+void multivariate_hypergeometric(gen_t& gen, 
+				 const std::vector<count_t>& caps,
+				 unsigned long draws,
+				 std::vector<count_t>& out) {
+  unsigned long remaining = 0;
+  for (unsigned int i=0; i < caps.size(); ++i)
+    remaining += caps[i];
+
+  out.resize(caps.size());
+  for (unsigned int i=0; i < caps.size(); ++i) {
+    out[i] = hypergeometric(gen, remaining, caps[i], draws);
+    draws -= out[i];
+    remaining -= caps[i];
+  }
+}
+
+#endif
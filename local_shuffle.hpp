@@ -0,0 +1,385 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Local shuffle kernels used by phase 2 of the permutation.
+
+   fisher_yates_shuffle - the sequential shuffle.
+   dart_shuffle - threads throw the elements into random slots of an 
+   oversized array in rounds, collisions going to the lowest element
+   index and the losers throwing again, and the occupied slots are then
+   compacted in order. The rule does not depend on slot numbers, so the
+   slots of the elements are a uniformly random choice and the compacted
+   order is a uniform random permutation; the same seed and thread count
+   give the same permutation.
+   bucket_shuffle - for buffers larger than the cache: every element goes
+   to a uniformly random bucket of about SP_BUCKET_ELEMENTS elements in one
+   streaming pass, then every bucket is shuffled in cache; as in phase 1,
+   concatenating the shuffled buckets gives a uniform permutation.
+
+   sp_phase2_calibration picks the kernel for a buffer size and thread 
+   count from a table measured once per machine by the calibrate tool.
+*/
+
+#ifndef SANDERS_LOCAL_SHUFFLE_HPP
+#define SANDERS_LOCAL_SHUFFLE_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <limits>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <boost/random/uniform_int_distribution.hpp>
+
+// number of slots per element in the dart array
+#define SP_DART_SLOTS_PER_ELEMENT 2
+// elements per bucket of bucket_shuffle, sized for the L2 cache
+#define SP_BUCKET_ELEMENTS (1U << 15)
+// buffers up to this many bytes are shuffled in cache without a table
+#define SP_PHASE2_CACHE_BYTES (4UL << 20)
+// calibration table read by SP_PHASE2_AUTO unless SP_PHASE2_CALIBRATION
+// names another file
+#define SP_PHASE2_CALIBRATION_FILE "phase2.cal"
+
+// local shuffle used in phase 2
+enum sp_phase2_engine {
+  SP_FISHER_YATES,
+  SP_DART_THROWING,
+  SP_BUCKET_SHUFFLE,
+  // chosen per call from the calibration table
+  SP_PHASE2_AUTO
+};
+
+template<typename perm_t, typename gen_t>
+void fisher_yates_shuffle(perm_t* data, unsigned int total, gen_t& gen) {
+  if (total > 1) {
+    for (int k=(total-1); k >=1; --k) {
+      boost::random::uniform_int_distribution<> dist(0, k);
+      int l = dist(gen);
+      perm_t t = data[k];
+      data[k] = data[l];
+      data[l] = t;
+    }
+  }
+}
+
+
+// Thread t draws from stream + (t+1) * 2^32 of a copy of gen and throws
+// the elements of chunk t. Throws go in rounds; a slot thrown at in a 
+// round goes to the lowest element index among the throws, or stays with 
+// the element of an earlier round, so the result only depends on the 
+// seed, the stream and nthreads, not on the timing of the threads.
+template<typename perm_t, typename gen_t>
+void dart_shuffle(perm_t* data, unsigned int total, unsigned int nthreads,
+		  const gen_t& gen, unsigned long seed, unsigned long stream) {
+  if (total <= 1)
+    return;
+
+  if (nthreads == 0)
+    nthreads = 1;
+
+  // a slot holds round << 32 | index of its element, empty if free; 
+  // smaller values win
+  const unsigned long empty = std::numeric_limits<unsigned long>::max();
+  unsigned long nslots = (unsigned long)total * SP_DART_SLOTS_PER_ELEMENT;
+  std::atomic<unsigned long>* slots = new std::atomic<unsigned long>[nslots];
+  std::vector<unsigned long> occupied(nthreads+1, 0);
+  std::vector<std::thread> threads;
+
+  // pending[t] - elements of chunk t still to throw, claimed[t] - those
+  // that won their slot when they threw in the current round, with the
+  // slot; a smaller claim of another thread may still take it
+  std::vector<std::vector<unsigned int> > pending(nthreads);
+  std::vector<std::vector<std::pair<unsigned int, unsigned long> > > 
+    claimed(nthreads);
+  std::vector<gen_t> tgens(nthreads, gen);
+
+  // thread t clears its chunk of the slots and lists its elements
+  for (unsigned int t=0; t < nthreads; ++t) {
+    threads.push_back(std::thread([=, &pending, &tgens]() {
+	  unsigned long sfirst = nslots * t / nthreads;
+	  unsigned long slast = nslots * (t+1) / nthreads;
+	  for (unsigned long s=sfirst; s < slast; ++s)
+	    slots[s].store(empty, std::memory_order_relaxed);
+
+	  unsigned int efirst = (unsigned long)total * t / nthreads;
+	  unsigned int elast = (unsigned long)total * (t+1) / nthreads;
+	  for (unsigned int e=efirst; e < elast; ++e)
+	    pending[t].push_back(e);
+	  tgens[t].seed(seed, stream + ((unsigned long)(t+1) << 32));
+	}));
+  }
+
+  for (unsigned int t=0; t < nthreads; ++t)
+    threads[t].join();
+  threads.clear();
+
+  unsigned long left = total;
+  for (unsigned long round=0; left > 0; ++round) {
+    // throw: claim the slot unless a smaller claim holds it; the losers
+    // throw again in the next round
+    for (unsigned int t=0; t < nthreads; ++t) {
+      threads.push_back(std::thread([=, &pending, &claimed, &tgens]() {
+	    boost::random::uniform_int_distribution<unsigned long> 
+	      dist(0, nslots-1);
+	    unsigned int lost = 0;
+	    claimed[t].clear();
+	    for (unsigned int k=0; k < pending[t].size(); ++k) {
+	      unsigned long s = dist(tgens[t]);
+	      unsigned long mine = (round << 32) | pending[t][k];
+	      unsigned long held = slots[s].load(std::memory_order_relaxed);
+	      while ((mine < held) && 
+		     !slots[s].compare_exchange_weak(held, mine,
+						     std::memory_order_relaxed))
+		;
+	      if (mine < held)
+		claimed[t].push_back(std::make_pair(pending[t][k], s));
+	      else
+		pending[t][lost++] = pending[t][k];
+	    }
+	    pending[t].resize(lost);
+	  }));
+    }
+
+    for (unsigned int t=0; t < nthreads; ++t)
+      threads[t].join();
+    threads.clear();
+
+    // resolve: claims taken over by a smaller one of another thread throw
+    // again; a single thread claims in increasing order and keeps all.
+    // Whether an element lost at once or later depends on the timing, so
+    // the next round throws in element order.
+    if (nthreads > 1) {
+      for (unsigned int t=0; t < nthreads; ++t) {
+	threads.push_back(std::thread([=, &pending, &claimed]() {
+	      for (unsigned int k=0; k < claimed[t].size(); ++k) {
+		unsigned long mine = (round << 32) | claimed[t][k].first;
+		if (slots[claimed[t][k].second].load(std::memory_order_relaxed)
+		    != mine)
+		  pending[t].push_back(claimed[t][k].first);
+	      }
+	      std::sort(pending[t].begin(), pending[t].end());
+	    }));
+      }
+
+      for (unsigned int t=0; t < nthreads; ++t)
+	threads[t].join();
+      threads.clear();
+    }
+
+    left = 0;
+    for (unsigned int t=0; t < nthreads; ++t)
+      left += pending[t].size();
+  }
+
+  // compact: count occupied slots per chunk, then copy at prefix offsets
+  std::vector<perm_t> values(data, data + total);
+  const perm_t* from = &values[0];
+  for (unsigned int t=0; t < nthreads; ++t) {
+    threads.push_back(std::thread([=, &occupied]() {
+	  unsigned long sfirst = nslots * t / nthreads;
+	  unsigned long slast = nslots * (t+1) / nthreads;
+	  unsigned long c = 0;
+	  for (unsigned long s=sfirst; s < slast; ++s)
+	    if (slots[s].load(std::memory_order_relaxed) != empty)
+	      ++c;
+	  occupied[t+1] = c;
+	}));
+  }
+
+  for (unsigned int t=0; t < nthreads; ++t)
+    threads[t].join();
+  threads.clear();
+
+  for (unsigned int t=1; t <= nthreads; ++t)
+    occupied[t] += occupied[t-1];
+
+  for (unsigned int t=0; t < nthreads; ++t) {
+    threads.push_back(std::thread([=, &occupied]() {
+	  unsigned long sfirst = nslots * t / nthreads;
+	  unsigned long slast = nslots * (t+1) / nthreads;
+	  unsigned long out = occupied[t];
+	  for (unsigned long s=sfirst; s < slast; ++s) {
+	    unsigned long v = slots[s].load(std::memory_order_relaxed);
+	    if (v != empty)
+	      data[out++] = from[v & 0xffffffffUL];
+	  }
+	}));
+  }
+
+  for (unsigned int t=0; t < nthreads; ++t)
+    threads[t].join();
+
+  delete[] slots;
+}
+
+
+template<typename perm_t, typename gen_t>
+void bucket_shuffle(perm_t* data, unsigned int total, gen_t& gen) {
+  unsigned int nbuckets = (total + SP_BUCKET_ELEMENTS - 1) / SP_BUCKET_ELEMENTS;
+  if (nbuckets <= 1) {
+    fisher_yates_shuffle(data, total, gen);
+    return;
+  }
+
+  boost::random::uniform_int_distribution<unsigned int> dist(0, nbuckets-1);
+  std::vector<unsigned int> bucket(total);
+  std::vector<unsigned int> offs(nbuckets+1, 0);
+  for (unsigned int i=0; i < total; ++i) {
+    bucket[i] = dist(gen);
+    ++offs[bucket[i]+1];
+  }
+
+  for (unsigned int b=1; b <= nbuckets; ++b)
+    offs[b] += offs[b-1];
+
+  std::vector<perm_t> scattered(total);
+  std::vector<unsigned int> next(offs.begin(), offs.end()-1);
+  for (unsigned int i=0; i < total; ++i)
+    scattered[next[bucket[i]]++] = data[i];
+
+  for (unsigned int b=0; b < nbuckets; ++b)
+    fisher_yates_shuffle(&scattered[offs[b]], offs[b+1]-offs[b], gen);
+
+  std::copy(scattered.begin(), scattered.end(), data);
+}
+
+
+inline const char* sp_phase2_engine_name(sp_phase2_engine e) {
+  switch (e) {
+  case SP_FISHER_YATES: return "fisher-yates";
+  case SP_DART_THROWING: return "dart";
+  case SP_BUCKET_SHUFFLE: return "bucket";
+  default: return "auto";
+  }
+}
+
+
+// Fastest kernel per thread count and buffer size. A line of the table
+// file reads "threads max_elements engine": up to max_elements elements
+// with that many threads, engine is the fastest. Lines starting with #
+// are comments.
+class sp_phase2_calibration {
+public:
+  bool empty() const { return entries.empty(); }
+
+  void add(unsigned int threads, unsigned long max_elements, 
+	   sp_phase2_engine e) {
+    entry en = { threads, max_elements, e };
+    entries.push_back(en);
+  }
+
+  bool load(const std::string& path) {
+    std::ifstream in(path.c_str());
+    if (!in)
+      return false;
+
+    entries.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.empty() || (line[0] == '#'))
+	continue;
+
+      std::istringstream fields(line);
+      entry en;
+      std::string name;
+      if (!(fields >> en.threads >> en.max_elements >> name))
+	continue;
+
+      en.engine = SP_FISHER_YATES;
+      if (name == sp_phase2_engine_name(SP_DART_THROWING))
+	en.engine = SP_DART_THROWING;
+      else if (name == sp_phase2_engine_name(SP_BUCKET_SHUFFLE))
+	en.engine = SP_BUCKET_SHUFFLE;
+      entries.push_back(en);
+    }
+    return !entries.empty();
+  }
+
+  bool save(const std::string& path) const {
+    std::ofstream out(path.c_str());
+    out << "# threads max_elements engine" << std::endl;
+    for (unsigned int k=0; k < entries.size(); ++k)
+      out << entries[k].threads << " " << entries[k].max_elements << " "
+	  << sp_phase2_engine_name(entries[k].engine) << std::endl;
+    return (bool)out;
+  }
+
+  // Uses the entries of the largest calibrated thread count not above
+  // threads and the smallest size not below total; without a table, 
+  // Fisher-Yates in cache, otherwise dart-throwing with threads and the 
+  // bucket shuffle without.
+  sp_phase2_engine choose(unsigned long total, unsigned int threads,
+			  unsigned long element_bytes) const {
+    if (entries.empty()) {
+      if (total * element_bytes <= SP_PHASE2_CACHE_BYTES)
+	return SP_FISHER_YATES;
+      return (threads > 1) ? SP_DART_THROWING : SP_BUCKET_SHUFFLE;
+    }
+
+    unsigned int best_threads = 0;
+    for (unsigned int k=0; k < entries.size(); ++k)
+      if ((entries[k].threads <= threads) && 
+	  (entries[k].threads > best_threads))
+	best_threads = entries[k].threads;
+    if (best_threads == 0) {
+      best_threads = entries[0].threads;
+      for (unsigned int k=1; k < entries.size(); ++k)
+	best_threads = std::min(best_threads, entries[k].threads);
+    }
+
+    const entry* fit = NULL;
+    const entry* largest = NULL;
+    for (unsigned int k=0; k < entries.size(); ++k) {
+      const entry& en = entries[k];
+      if (en.threads != best_threads)
+	continue;
+      if ((largest == NULL) || (en.max_elements > largest->max_elements))
+	largest = &en;
+      if ((en.max_elements >= total) && 
+	  ((fit == NULL) || (en.max_elements < fit->max_elements)))
+	fit = &en;
+    }
+    return fit ? fit->engine : largest->engine;
+  }
+
+private:
+  struct entry {
+    unsigned int threads;
+    unsigned long max_elements;
+    sp_phase2_engine engine;
+  };
+
+  std::vector<entry> entries;
+};
+
+#endif
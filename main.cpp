@@ -27,8 +27,189 @@
 //  Authors: Thejaka Kanewala
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
+#include <limits>
 #include <mpi.h>
 #include "sanders_perm.hpp"
+#include "minhash.hpp"
+#include "small_perm.hpp"
+#include "perm_cycles.hpp"
+#include "perm_reblock.hpp"
+#include "sanders_split.hpp"
+#include "valiant_router.hpp"
+#include "packed_perm_vector.hpp"
+#include "perm_uring_sink.hpp"
+#include "perm_shm_sink.hpp"
+
+#ifdef SP_WITH_PBGL
+#include "perm_property_map.hpp"
+#endif
+
+// Times the phase 2 shuffle kernels on a local buffer of n elements.
+void benchmark_phase2(unsigned long int n) {
+  std::vector<unsigned long int> buf(n);
+  for (unsigned long int i=0; i < n; ++i)
+    buf[i] = i;
+
+  sp_mt19937_rng gen;
+  gen.seed(SP_DEFAULT_SEED, 0);
+  double start = MPI_Wtime();
+  fisher_yates_shuffle(&buf[0], n, gen);
+  std::cout << "fisher-yates : " << (MPI_Wtime() - start) 
+	    << " s" << std::endl;
+
+  unsigned int maxthreads = std::thread::hardware_concurrency();
+  for (unsigned int t=1; t <= maxthreads; t *= 2) {
+    start = MPI_Wtime();
+    dart_shuffle(&buf[0], n, t, gen, SP_DEFAULT_SEED, 0);
+    std::cout << "dart-throwing, " << t << " threads : " 
+	      << (MPI_Wtime() - start) << " s" << std::endl;
+  }
+
+  start = MPI_Wtime();
+  bucket_shuffle(&buf[0], n, gen);
+  std::cout << "bucket : " << (MPI_Wtime() - start) << " s" << std::endl;
+
+  sp_aes_ctr_rng aes;
+  aes.seed(SP_DEFAULT_SEED, 0);
+  start = MPI_Wtime();
+  fisher_yates_shuffle(&buf[0], n, aes);
+  std::cout << "fisher-yates, aes-ctr : " << (MPI_Wtime() - start)
+	    << " s" << std::endl;
+}
+
+
+// Sends n items per rank to the first quarter of the ranks, directly and
+// through the Valiant router, and times both.
+void benchmark_router(int N, unsigned long int n) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  int hot = std::max(N/4, 1);
+  std::vector<int> dests(n);
+  std::vector<unsigned long int> payloads(n);
+  for (unsigned long int i=0; i < n; ++i) {
+    dests[i] = (rank + i) % hot;
+    payloads[i] = i;
+  }
+
+  std::vector<unsigned long int> received;
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  sp_exchange_by_dest(payloads, dests, N, MPI_UNSIGNED_LONG, received);
+  double direct = MPI_Wtime() - start;
+
+  valiant_router<unsigned long int> router;
+  MPI_Barrier(MPI_COMM_WORLD);
+  start = MPI_Wtime();
+  router.route(dests, payloads, received);
+  double routed = MPI_Wtime() - start;
+
+  if (rank == 0)
+    std::cout << "direct : " << direct << " s, valiant : " << routed 
+	      << " s" << std::endl;
+}
+
+
+// Times permute with every phase 1 exchange strategy.
+void benchmark_exchange(int N, unsigned long int n) {
+  const char* names[] = { "alltoallv", "butterfly", "pairwise" };
+  sp_exchange_strategy strategies[] = { SP_ALLTOALLV, SP_BUTTERFLY, 
+					SP_PAIRWISE };
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  for (unsigned int s=0; s < sizeof(strategies)/sizeof(strategies[0]); ++s) {
+    sanders_permutation<unsigned long int> sp(n);
+    sp.set_exchange(strategies[s]);
+    std::vector<unsigned long int> out;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    sp.permute(N, out);
+    double elapsed = MPI_Wtime() - start;
+
+    if (rank == 0)
+      std::cout << names[s] << " : " << elapsed << " s" << std::endl;
+  }
+}
+
+
+// Hashes n elements per rank with k = 64 MinHash permutations of [0, N*n)
+// and reports the aggregate hash rate.
+void benchmark_minhash(int N, unsigned long int n) {
+  const unsigned int k = 64;
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  minhash<> mh(n*N, k);
+  std::vector<unsigned long int> elems(n);
+  for (unsigned long int i=0; i < n; ++i)
+    elems[i] = rank*n + i;
+  std::vector<unsigned long int> sig(k);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  mh.signature(elems.data(), n, sig.data());
+  double elapsed = MPI_Wtime() - start;
+
+  double maxelapsed;
+  unsigned long int hashes = n*k, total;
+  MPI_Reduce(&elapsed, &maxelapsed, 1, MPI_DOUBLE, MPI_MAX, 0,
+	     MPI_COMM_WORLD);
+  MPI_Reduce(&hashes, &total, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0,
+	     MPI_COMM_WORLD);
+  if (rank == 0)
+    std::cout << "minhash : " << total << " hashes, " << maxelapsed
+	      << " s, " << (total / maxelapsed) << " hashes/s" << std::endl;
+}
+
+
+// Counts the generated permutations and keeps their first values live.
+struct small_perm_counter {
+  std::atomic<unsigned long> perms;
+  std::atomic<unsigned long> checksum;
+
+  template<typename perm_t>
+  void operator()(unsigned long first, const perm_t* perms_rows,
+		  unsigned int count) {
+    perms += count;
+    checksum += perms_rows[0];
+  }
+};
+
+
+// Generates 2^27 elements worth of permutations of n elements, split over
+// the ranks, and reports the aggregate permutations/s. perm_t must hold
+// n-1.
+template<typename perm_t>
+void benchmark_small_perm(unsigned long int n) {
+  const unsigned long int total = std::max((1UL << 27) / n, 1UL);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  small_permutations<perm_t> sp(n);
+  small_perm_counter counter;
+  counter.perms = 0;
+  counter.checksum = 0;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double start = MPI_Wtime();
+  sp.generate_distributed(total, counter);
+  double elapsed = MPI_Wtime() - start;
+
+  double maxelapsed;
+  unsigned long int perms = counter.perms, sum;
+  MPI_Reduce(&elapsed, &maxelapsed, 1, MPI_DOUBLE, MPI_MAX, 0,
+	     MPI_COMM_WORLD);
+  MPI_Reduce(&perms, &sum, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0,
+	     MPI_COMM_WORLD);
+  if (rank == 0)
+    std::cout << "small permutations, n=" << n << " : " << sum 
+	      << " permutations, " << maxelapsed << " s, " 
+	      << (sum / maxelapsed) << " permutations/s" << std::endl;
+}
 
 
 int main(int argc, char* argv[]) {
@@ -42,9 +223,205 @@ int main(int argc, char* argv[]) {
 	    << std::endl;
 
   unsigned long int n = 32;
+  if (argc > 1)
+    n = std::strtoul(argv[1], NULL, 10);
+
+  std::string mode = "permute";
+  if (argc > 2)
+    mode = argv[2];
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (mode == "phase2-bench") {
+    if (rank == 0)
+      benchmark_phase2(n);
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "minhash-bench") {
+    benchmark_minhash(N, n);
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "roofline") {
+    sp_roofline roofline;
+    roofline.probe();
+    sanders_permutation<unsigned long int> sp(n);
+    sp.set_roofline(&roofline);
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+    roofline.report();
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "wait-profile") {
+    sp_wait_profile waits;
+    sanders_permutation<unsigned long int> sp(n);
+    sp.set_wait_profile(&waits);
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+    waits.report();
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "small-perm-bench") {
+    // 16 bit elements as far as they go
+    if ((n == 0) || (n > std::numeric_limits<unsigned int>::max())) {
+      if (rank == 0)
+	sp_error("Small permutations", "-", "n must be in [1, 2^32 - 1]");
+    } else if (n - 1 <= std::numeric_limits<uint16_t>::max()) {
+      benchmark_small_perm<uint16_t>(n);
+    } else {
+      benchmark_small_perm<uint32_t>(n);
+    }
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "cycles") {
+    sanders_permutation<unsigned long int> sp(n);
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+
+    sp_cycle_stats stats;
+    cycle_structure(n, N, out, stats);
+    if (rank == 0) {
+      std::cout << "fixed points : " << stats.fixed_points
+		<< ", cycles : " << stats.cycles 
+		<< ", rounds : " << stats.rounds << std::endl;
+      for (int b=0; b < SP_CYCLE_BINS; ++b)
+	if (stats.histogram[b])
+	  std::cout << "cycle length [" << (1UL << b) << ", " 
+		    << (2UL << b) << ") : " << stats.histogram[b] << std::endl;
+    }
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "reblock") {
+    sanders_permutation<unsigned long int> sp(n);
+    std::vector<unsigned long int> out, moved;
+    sp.permute(N, out);
+
+    // shrink to half the ranks, as a rescaled job would
+    int N_new = (N > 1) ? N/2 : 1;
+    double start = MPI_Wtime();
+    reblock(n, N, N_new, out, moved);
+    double secs = MPI_Wtime() - start;
+    if (rank == 0)
+      std::cout << "reblock " << N << " -> " << N_new << " ranks : " 
+		<< secs << " s" << std::endl;
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "reshuffle") {
+    double fraction = 0.1;
+    if (argc > 3)
+      fraction = std::strtod(argv[3], NULL);
+
+    sanders_permutation<unsigned long int> sp(n);
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+
+    double start = MPI_Wtime();
+    sp.set_seed(SP_DEFAULT_SEED + 1);
+    sp.reshuffle(N, fraction, out);
+    double secs = MPI_Wtime() - start;
+    if (rank == 0)
+      std::cout << "reshuffle of " << fraction << " of " << n << " : " 
+		<< secs << " s" << std::endl;
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "split") {
+    // train/validation/test sets of 80/10/10 percent
+    sanders_split<unsigned long int> ss(n);
+    std::vector<unsigned long int> sizes(3);
+    sizes[0] = (n / 10) * 8;
+    sizes[1] = n / 10;
+    sizes[2] = n - sizes[0] - sizes[1];
+
+    std::vector<unsigned int> membership;
+    std::vector<std::vector<unsigned long int> > groups;
+    double start = MPI_Wtime();
+    ss.split(N, sizes, membership, groups);
+    double secs = MPI_Wtime() - start;
+    if (rank == 0)
+      std::cout << "split of " << n << " into " << sizes[0] << ", " 
+		<< sizes[1] << ", " << sizes[2] << " : " << secs << " s" 
+		<< std::endl;
+    MPI_Finalize();
+    return 0;
+  }
+
+#ifdef SP_WITH_PBGL
+  if (mode == "property-map") {
+    sanders_permutation<unsigned long int> sp(n);
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+
+    // every rank looks up the labels of the first few indices
+    boost::graph::distributed::mpi_process_group pg;
+    sp_permutation_map<unsigned long int>::type pmap = 
+      make_permutation_map(pg, n, out);
+    unsigned long int lookups = std::min(n, 8UL);
+    for (unsigned long int k=0; k < lookups; ++k)
+      request(pmap, k);
+    synchronize(pmap);
+
+    if (rank == 0) {
+      for (unsigned long int k=0; k < lookups; ++k)
+	std::cout << k << " -> " << get(pmap, k) << std::endl;
+    }
+    MPI_Finalize();
+    return 0;
+  }
+#endif
+
+  if (mode == "router-bench") {
+    benchmark_router(N, n);
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (mode == "exchange-bench") {
+    benchmark_exchange(N, n);
+    MPI_Finalize();
+    return 0;
+  }
+
+  // permute [sink [path]] - sink is vector (default), packed, uring, 
+  // writing <path>.<rank>, or shm
+  std::string sinkname = "vector";
+  if ((mode == "permute") && (argc > 3))
+    sinkname = argv[3];
+
   sanders_permutation<unsigned long int> sp(n);
-  std::vector<unsigned long int> out;
-  sp.permute(N, out);
+  double start = MPI_Wtime();
+  if (sinkname == "packed") {
+    packed_perm_vector<unsigned long int> pv(n);
+    sp_packed_sink<unsigned long int> sink(pv);
+    sp.permute_into(N, sink);
+  } else if (sinkname == "uring") {
+    sp_uring_sink<unsigned long int> sink(argc > 4 ? argv[4] : "permutation");
+    sp.permute_into(N, sink);
+  } else if (sinkname == "shm") {
+    sp_shm_sink<unsigned long int> sink;
+    sp.permute_into(N, sink);
+  } else {
+    std::vector<unsigned long int> out;
+    sp.permute(N, out);
+  }
+  double secs = MPI_Wtime() - start;
+  if ((rank == 0) && (argc > 3))
+    std::cout << "permute into " << sinkname << " sink : " << secs << " s"
+	      << std::endl;
 
   MPI_Finalize();
 
@@ -0,0 +1,200 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   MinHash signatures from k implicit random permutations of [0, n).
+
+   Permutation j is a keyed bijection: a four-round Feistel network over
+   the smallest even number of bits that covers n, with cycle walking for
+   values that land outside [0, n). Elements are hashed in batches laid out
+   as separate arrays of 32-bit halves so that the rounds vectorize; the
+   few values that need cycle walking are finished one by one.
+
+   The round keys are drawn from a stream shared by all ranks, seeded like
+   sanders_permutation (set_seed), so every rank and every run with the 
+   same seed uses the same k permutations. Sets are distributed over the 
+   ranks and every rank computes the signatures of its own sets.
+*/
+
+#ifndef SANDERS_MINHASH_HPP
+#define SANDERS_MINHASH_HPP
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+
+#include "sanders_rng.hpp"
+
+#define SP_FEISTEL_ROUNDS 4
+// elements hashed per batch
+#define SP_MINHASH_BATCH 256
+
+template<typename rng_t = sp_mt19937_rng>
+class minhash {
+public:
+  // n - size of the universe, k - number of permutations
+  minhash(unsigned long pn, unsigned int pk, const rng_t& g = rng_t())
+    : n(pn), k(pk), gen(g) {
+    // at most 32 bits per half; shifting by 64 would be undefined
+    half = 1;
+    while ((half < 32) && (n > 1) && ((n - 1) >> (2*half)) != 0)
+      ++half;
+    mask = (half >= 32) ? 0xffffffffU : ((1U << half) - 1);
+    set_seed(SP_DEFAULT_SEED);
+  }
+
+  void set_seed(unsigned long s) {
+    gen.seed(s, SP_MINHASH_STREAMS);
+    keys.resize(k*SP_FEISTEL_ROUNDS);
+    for (unsigned int i=0; i < keys.size(); ++i)
+      keys[i] = gen();
+  }
+
+  unsigned int size() const { return k; }
+
+  // out[i] - image of in[i] under permutation j; elements outside of 
+  // [0, n), all of them for n == 0, are copied unchanged
+  void hash_batch(unsigned int j, const unsigned long* in, unsigned long* out,
+		  unsigned int count) const;
+
+  // sig[j] - minimum image of the set under permutation j, n if empty
+  void signature(const unsigned long* elems, unsigned int count,
+		 unsigned long* sig) const;
+
+  // Signatures of the local sets; set s holds elems[offsets[s]] to 
+  // elems[offsets[s+1]-1]. sigs receives k values per set.
+  void signatures(const std::vector<unsigned long>& offsets,
+		  const std::vector<unsigned long>& elems,
+		  std::vector<unsigned long>& sigs) const;
+
+private:
+  unsigned long n;
+  unsigned int k;
+  unsigned int half;
+  uint32_t mask;
+  rng_t gen;
+  std::vector<uint32_t> keys;
+
+  static uint32_t round_function(uint32_t x, uint32_t key) {
+    x ^= key;
+    x *= 0x9e3779b1U;
+    x ^= x >> 15;
+    x *= 0x85ebca6bU;
+    x ^= x >> 13;
+    return x;
+  }
+
+  unsigned long encrypt(unsigned int j, unsigned long x) const {
+    uint32_t l = (uint32_t)(x >> half) & mask;
+    uint32_t r = (uint32_t)x & mask;
+    const uint32_t* kj = &keys[j*SP_FEISTEL_ROUNDS];
+    for (unsigned int i=0; i < SP_FEISTEL_ROUNDS; ++i) {
+      uint32_t t = l ^ (round_function(r, kj[i]) & mask);
+      l = r;
+      r = t;
+    }
+    return ((unsigned long)l << half) | r;
+  }
+};
+
+
+template<typename rng_t>
+void 
+minhash<rng_t>::hash_batch(unsigned int j, const unsigned long* in, 
+			   unsigned long* out, unsigned int count) const {
+  uint32_t l[SP_MINHASH_BATCH], r[SP_MINHASH_BATCH];
+  const uint32_t* kj = &keys[j*SP_FEISTEL_ROUNDS];
+  const uint32_t m = mask;
+  const unsigned int h = half;
+
+  for (unsigned int b=0; b < count; b += SP_MINHASH_BATCH) {
+    unsigned int c = std::min(count - b, (unsigned int)SP_MINHASH_BATCH);
+
+    for (unsigned int i=0; i < c; ++i) {
+      l[i] = (uint32_t)(in[b+i] >> h) & m;
+      r[i] = (uint32_t)in[b+i] & m;
+    }
+
+    for (unsigned int round=0; round < SP_FEISTEL_ROUNDS; ++round) {
+      const uint32_t key = kj[round];
+      for (unsigned int i=0; i < c; ++i) {
+	uint32_t t = l[i] ^ (round_function(r[i], key) & m);
+	l[i] = r[i];
+	r[i] = t;
+      }
+    }
+
+    for (unsigned int i=0; i < c; ++i)
+      out[b+i] = ((unsigned long)l[i] << h) | r[i];
+
+    // cycle walking for the values outside of [0, n); it only ends for
+    // inputs inside
+    for (unsigned int i=0; i < c; ++i) {
+      if (in[b+i] >= n) {
+	out[b+i] = in[b+i];
+	continue;
+      }
+
+      while (out[b+i] >= n)
+	out[b+i] = encrypt(j, out[b+i]);
+    }
+  }
+}
+
+
+template<typename rng_t>
+void 
+minhash<rng_t>::signature(const unsigned long* elems, unsigned int count,
+			  unsigned long* sig) const {
+  unsigned long hashed[SP_MINHASH_BATCH];
+  for (unsigned int j=0; j < k; ++j) {
+    unsigned long best = n;
+    for (unsigned int b=0; b < count; b += SP_MINHASH_BATCH) {
+      unsigned int c = std::min(count - b, (unsigned int)SP_MINHASH_BATCH);
+      hash_batch(j, &elems[b], hashed, c);
+      for (unsigned int i=0; i < c; ++i)
+	best = std::min(best, hashed[i]);
+    }
+    sig[j] = best;
+  }
+}
+
+
+template<typename rng_t>
+void 
+minhash<rng_t>::signatures(const std::vector<unsigned long>& offsets,
+			   const std::vector<unsigned long>& elems,
+			   std::vector<unsigned long>& sigs) const {
+  unsigned long nsets = offsets.empty() ? 0 : (offsets.size() - 1);
+  sigs.resize(nsets*k);
+  for (unsigned long s=0; s < nsets; ++s)
+    signature(elems.data() + offsets[s], offsets[s+1] - offsets[s], 
+	      &sigs[s*k]);
+}
+
+#endif
@@ -0,0 +1,144 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Bit-packed storage for a block of the permutation.
+
+   Every entry takes ceil(log2 n) bits, packed back to back in 64-bit
+   words; an entry may straddle two words. One spare word at the end lets
+   get read two words without a bounds check, so random access is a
+   constant number of shifts. unpack decodes a range into perm_t values
+   with a branch free loop the compiler can vectorize.
+
+   sp_packed_sink fills a packed_perm_vector directly from phase 3:
+
+     packed_perm_vector<unsigned long> pv(n);
+     sp_packed_sink<unsigned long> sink(pv);
+     sp.permute_into(N, sink);
+*/
+
+#ifndef SANDERS_PACKED_PERM_VECTOR_HPP
+#define SANDERS_PACKED_PERM_VECTOR_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include "perm_sinks.hpp"
+
+template<typename perm_t>
+class packed_perm_vector {
+public:
+  // n - size of the permutation, every entry is in [0, n)
+  packed_perm_vector(perm_t n) : bits(1), count(0) {
+    while (bits < 64 && (((uint64_t)n - 1) >> bits) != 0)
+      ++bits;
+    mask = (bits == 64) ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+    words.resize(1, 0);
+  }
+
+  void resize(unsigned long size) {
+    count = size;
+    words.assign((count*bits + 63)/64 + 1, 0);
+  }
+
+  unsigned long size() const { return count; }
+
+  unsigned int bits_per_entry() const { return bits; }
+
+  // bytes of packed storage
+  unsigned long memory() const { return words.size() * sizeof(uint64_t); }
+
+  perm_t get(unsigned long i) const {
+    uint64_t bit = (uint64_t)i * bits;
+    uint64_t w = bit >> 6;
+    unsigned int shift = bit & 63;
+    // the second shift is split in two so that shift == 0 is defined
+    uint64_t v = (words[w] >> shift) | ((words[w+1] << 1) << (63 - shift));
+    return (perm_t)(v & mask);
+  }
+
+  perm_t operator[](unsigned long i) const { return get(i); }
+
+  void set(unsigned long i, perm_t value) {
+    uint64_t bit = (uint64_t)i * bits;
+    uint64_t w = bit >> 6;
+    unsigned int shift = bit & 63;
+    uint64_t v = (uint64_t)value & mask;
+    words[w] = (words[w] & ~(mask << shift)) | (v << shift);
+    if (shift + bits > 64) {
+      unsigned int spill = 64 - shift;
+      words[w+1] = (words[w+1] & ~(mask >> spill)) | (v >> spill);
+    }
+  }
+
+  // out[0..len) - entries [first, first+len)
+  void unpack(unsigned long first, unsigned long len, perm_t* out) const {
+    const uint64_t* wp = words.data();
+    const uint64_t m = mask;
+    const uint64_t b = bits;
+    for (unsigned long i=0; i < len; ++i) {
+      uint64_t bit = (first + i) * b;
+      uint64_t w = bit >> 6;
+      unsigned int shift = bit & 63;
+      out[i] = (perm_t)(((wp[w] >> shift) | 
+			 ((wp[w+1] << 1) << (63 - shift))) & m);
+    }
+  }
+
+  // entries [first, first+len) - values[0..len)
+  void pack(unsigned long first, unsigned long len, const perm_t* values) {
+    for (unsigned long i=0; i < len; ++i)
+      set(first + i, values[i]);
+  }
+
+private:
+  unsigned int bits;
+  uint64_t mask;
+  unsigned long count;
+  std::vector<uint64_t> words;
+};
+
+
+// Packs the local block of phase 3 into a packed_perm_vector.
+template<typename perm_t>
+class sp_packed_sink : public sp_output_sink<perm_t> {
+public:
+  sp_packed_sink(packed_perm_vector<perm_t>& v) : out(v) {}
+
+  void begin(perm_t pos, unsigned int count) {
+    out.resize(count);
+  }
+
+  void put(unsigned int off, const perm_t* values, unsigned int count) {
+    out.pack(off, count, values);
+  }
+
+private:
+  packed_perm_vector<perm_t>& out;
+};
+
+#endif
@@ -0,0 +1,197 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Cycle structure of a distributed permutation.
+
+   cycle_structure computes the number of fixed points, the number of
+   cycles and a histogram of the cycle lengths of a permutation stored in
+   blocks as permute leaves it (rank r holds p(i) for i in [r*m, r*m+m),
+   m = ceil(n/N)), without gathering it.
+
+   Every element i starts with jump(i) = p(i) and label(i) = min(i, p(i)).
+   Pointer jumping doubles the window of every element in each round,
+
+     label(i) = min(label(i), label(jump(i))),  jump(i) = jump(jump(i)),
+
+   fetching label and jump of the remote targets with one batched 
+   request/reply pair of Alltoallv per round. When a round changes no 
+   label, every label is the smallest element of its cycle and later rounds
+   would not change it either, so the loop stops after O(log n) rounds, 
+   fewer for short cycles. Each element then reports its label to the 
+   owner of the label (counted locally first), which learns the length of
+   the cycle it heads.
+*/
+
+#ifndef SANDERS_PERM_CYCLES_HPP
+#define SANDERS_PERM_CYCLES_HPP
+
+#include <mpi.h>
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "perm_exchange.hpp"
+#include "perm_error.hpp"
+
+// number of histogram bins; bin b counts cycles of length [2^b, 2^(b+1))
+#define SP_CYCLE_BINS 64
+
+struct sp_cycle_stats {
+  unsigned long fixed_points;
+  unsigned long cycles;
+  unsigned long histogram[SP_CYCLE_BINS];
+  // pointer jumping rounds
+  unsigned int rounds;
+};
+
+
+// n - size of the permutation, p_out - local block. Collective; stats
+// are the same on every rank.
+template<typename perm_t>
+void cycle_structure(perm_t n, int N, const std::vector<perm_t>& p_out,
+		     sp_cycle_stats& stats) {
+  struct pair_t {
+    perm_t first;
+    perm_t second;
+  };
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  perm_t m = (perm_t)std::ceil((double)n/(double)N);
+  perm_t pos = rank * m;
+  unsigned long count = p_out.size();
+
+  MPI_Datatype single, pair;
+  MPI_Type_contiguous(sizeof(perm_t), MPI_BYTE, &single);
+  MPI_Type_commit(&single);
+  MPI_Type_contiguous(sizeof(pair_t), MPI_BYTE, &pair);
+  MPI_Type_commit(&pair);
+
+  std::vector<perm_t> label(count), jump(count);
+  unsigned long local[2 + SP_CYCLE_BINS] = { 0 };
+  for (unsigned long i=0; i < count; ++i) {
+    jump[i] = p_out[i];
+    label[i] = std::min(pos + (perm_t)i, p_out[i]);
+    if (p_out[i] == pos + (perm_t)i)
+      ++local[0];
+  }
+
+  // order[k] - element whose request is k-th in the send buffer
+  std::vector<unsigned long> order(count);
+  std::vector<perm_t> requests(count), received;
+  std::vector<pair_t> replies, answers;
+  std::vector<unsigned int> owners(count);
+  std::vector<int> sendcnts(N), sdispls, recvcnts;
+
+  stats.rounds = 0;
+  int changed = 1;
+  while (changed) {
+    // requests grouped by the owner of the target
+    for (unsigned long i=0; i < count; ++i)
+      owners[i] = jump[i] / m;
+    sp_bucket_by_dest(jump.data(), owners.data(), count, N, 
+		      requests.data(), sendcnts, sdispls, order.data());
+
+    sp_exchange_grouped(requests, sendcnts, N, single, received, recvcnts);
+
+    // answers with the values of the previous round
+    replies.resize(received.size());
+    for (unsigned long k=0; k < received.size(); ++k) {
+      replies[k].first = label[received[k] - pos];
+      replies[k].second = jump[received[k] - pos];
+    }
+
+    std::vector<int> replycnts;
+    sp_exchange_grouped(replies, recvcnts, N, pair, answers, replycnts);
+
+    int mine = 0;
+    for (unsigned long k=0; k < count; ++k) {
+      unsigned long i = order[k];
+      if (answers[k].first < label[i]) {
+	label[i] = answers[k].first;
+	mine = 1;
+      }
+      jump[i] = answers[k].second;
+    }
+
+    if (MPI_Allreduce(&mine, &changed, 1, MPI_INT, MPI_LOR, 
+		      MPI_COMM_WORLD) != 0)
+      sp_error("Cycles", "MPI_Allreduce", "Error agreeing on another round");
+    ++stats.rounds;
+  }
+
+  // (label, number of local elements with it), grouped by label owner
+  std::sort(label.begin(), label.end());
+  std::vector<pair_t> tallies;
+  sendcnts.assign(N, 0);
+  for (unsigned long i=0; i < count; ) {
+    unsigned long j = i;
+    while ((j < count) && (label[j] == label[i]))
+      ++j;
+    pair_t t;
+    t.first = label[i];
+    t.second = j - i;
+    tallies.push_back(t);
+    ++sendcnts[label[i] / m];
+    i = j;
+  }
+
+  std::vector<pair_t> heads;
+  sp_exchange_grouped(tallies, sendcnts, N, pair, heads, recvcnts);
+
+  std::vector<unsigned long> lengths(count, 0);
+  for (unsigned long k=0; k < heads.size(); ++k)
+    lengths[heads[k].first - pos] += heads[k].second;
+
+  for (unsigned long i=0; i < count; ++i) {
+    if (lengths[i] == 0)
+      continue;
+    ++local[1];
+    unsigned int b = 0;
+    while ((lengths[i] >> (b+1)) != 0)
+      ++b;
+    ++local[2+b];
+  }
+
+  unsigned long global[2 + SP_CYCLE_BINS];
+  if (MPI_Allreduce(local, global, 2 + SP_CYCLE_BINS, MPI_UNSIGNED_LONG, 
+		    MPI_SUM, MPI_COMM_WORLD) != 0)
+    sp_error("Cycles", "MPI_Allreduce", "Error summing the statistics");
+
+  stats.fixed_points = global[0];
+  stats.cycles = global[1];
+  for (int b=0; b < SP_CYCLE_BINS; ++b)
+    stats.histogram[b] = global[2+b];
+
+  MPI_Type_free(&single);
+  MPI_Type_free(&pair);
+}
+
+#endif
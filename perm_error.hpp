@@ -0,0 +1,51 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Error reporting shared by the permutation headers.
+
+   sp_error prints one line per failed call in the format of 
+   sanders_permutation::error:
+     [ERROR] <component> -- MPI function : <call>, description : <text>
+   Failures that do not come from a call pass "-" as the call, and calls
+   that are not MPI functions name their kind.
+*/
+
+#ifndef SANDERS_PERM_ERROR_HPP
+#define SANDERS_PERM_ERROR_HPP
+
+#include <string>
+#include <iostream>
+
+inline void sp_error(const std::string& component, const std::string& fn,
+		     const std::string& desc, 
+		     const std::string& kind = "MPI function") {
+  std::cout << "[ERROR] " << component << " -- " << kind << " : " << fn
+	    << ", description : " << desc << std::endl;
+}
+
+#endif
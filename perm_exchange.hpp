@@ -0,0 +1,135 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Exchanges of items grouped by destination rank.
+
+   sp_bucket_by_dest is the counting sort phase 1 and the other exchanges
+   use to group items by key before an Alltoallv. sp_exchange_grouped
+   exchanges the counts and then the items of an already grouped buffer;
+   sp_exchange_by_dest does both.
+*/
+
+#ifndef SANDERS_PERM_EXCHANGE_HPP
+#define SANDERS_PERM_EXCHANGE_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <cstddef>
+#include <iostream>
+
+#include "perm_wait_profile.hpp"
+#include "perm_error.hpp"
+
+// Stable counting sort of items[0..count) by dests[k] in [0, nkeys).
+// sendcnts[d] - items with key d, sdispls[d] - first of them in sendbuf,
+// sdispls[nkeys] - count. order[j], if given, is the index in items of 
+// sendbuf[j].
+template<typename item_t, typename key_t>
+void sp_bucket_by_dest(const item_t* items, const key_t* dests, 
+		       std::size_t count, unsigned int nkeys,
+		       item_t* sendbuf,
+		       std::vector<int>& sendcnts, std::vector<int>& sdispls,
+		       unsigned long* order = NULL) {
+  sendcnts.assign(nkeys, 0);
+  sdispls.assign(nkeys+1, 0);
+
+  for (std::size_t k=0; k < count; ++k)
+    ++sendcnts[dests[k]];
+
+  for (unsigned int d=0; d < nkeys; ++d)
+    sdispls[d+1] = sdispls[d] + sendcnts[d];
+
+  std::vector<int> offs(sdispls.begin(), sdispls.end()-1);
+  for (std::size_t k=0; k < count; ++k) {
+    int j = offs[dests[k]]++;
+    sendbuf[j] = items[k];
+    if (order)
+      order[j] = k;
+  }
+}
+
+// Sends sendbuf, grouped by destination with sendcnts items per rank, and
+// replaces out with what this rank receives, recvcnts items per source.
+// type describes one item. waits, if given, profiles both collectives 
+// under phase.
+template<typename item_t>
+void sp_exchange_grouped(const std::vector<item_t>& sendbuf, 
+			 const std::vector<int>& sendcnts, int N, 
+			 MPI_Datatype type, std::vector<item_t>& out,
+			 std::vector<int>& recvcnts,
+			 sp_wait_profile* waits = NULL,
+			 sp_phase phase = SP_PHASE_IDLE) {
+  std::vector<int> sdispls(N+1, 0), rdispls(N+1, 0);
+  recvcnts.assign(N, 0);
+
+  if (waits)
+    waits->enter(phase, "MPI_Alltoall");
+  if (MPI_Alltoall(const_cast<int*>(&sendcnts[0]), 1, MPI_INT, 
+		   &recvcnts[0], 1, MPI_INT, MPI_COMM_WORLD) != 0)
+    sp_error("Exchange", "MPI_Alltoall", "Error exchanging counts");
+  if (waits)
+    waits->exit();
+
+  for (int rp=0; rp < N; ++rp) {
+    sdispls[rp+1] = sdispls[rp] + sendcnts[rp];
+    rdispls[rp+1] = rdispls[rp] + recvcnts[rp];
+  }
+
+  out.resize(rdispls[N] + 1);
+  if (waits)
+    waits->enter(phase, "MPI_Alltoallv");
+  if (MPI_Alltoallv((void*)(sendbuf.empty() ? NULL : &sendbuf[0]), 
+		    const_cast<int*>(&sendcnts[0]), &sdispls[0], type, 
+		    &out[0], &recvcnts[0], &rdispls[0], type, 
+		    MPI_COMM_WORLD) != 0)
+    sp_error("Exchange", "MPI_Alltoallv", "Error exchanging items");
+  if (waits)
+    waits->exit();
+  out.resize(rdispls[N]);
+}
+
+// Sends items[i] to rank dests[i] and replaces out with what this rank
+// receives, grouped by source. type describes one item.
+template<typename item_t>
+void sp_exchange_by_dest(const std::vector<item_t>& items, 
+			 const std::vector<int>& dests,
+			 int N, MPI_Datatype type,
+			 std::vector<item_t>& out,
+			 sp_wait_profile* waits = NULL,
+			 sp_phase phase = SP_PHASE_IDLE) {
+  std::vector<item_t> sendbuf(items.size()+1);
+  std::vector<int> sendcnts, sdispls, recvcnts;
+  sp_bucket_by_dest(items.empty() ? NULL : &items[0], 
+		    dests.empty() ? NULL : &dests[0], items.size(), N,
+		    &sendbuf[0], sendcnts, sdispls);
+  sendbuf.resize(items.size());
+  sp_exchange_grouped(sendbuf, sendcnts, N, type, out, recvcnts, 
+		      waits, phase);
+}
+
+#endif
@@ -0,0 +1,96 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Pacing of the exchanges against a bandwidth cap.
+
+   sp_token_bucket holds up to burst bytes of credit and earns rate bytes
+   per second. acquire(bytes) takes the credit for a transfer, sleeping 
+   until enough has accumulated; a transfer larger than the burst waits 
+   for a full bucket and leaves it in debt. With rate 0 it never waits.
+*/
+
+#ifndef SANDERS_PERM_PACING_HPP
+#define SANDERS_PERM_PACING_HPP
+
+#include <mpi.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+// bytes per paced chunk of the exchanges
+#define SP_PACING_CHUNK (1UL << 20)
+
+class sp_token_bucket {
+public:
+  sp_token_bucket(double r = 0, double b = SP_PACING_CHUNK)
+    : rate(r), burst(b) {
+    reset();
+  }
+
+  void configure(double r, double b) {
+    rate = r;
+    burst = b;
+    reset();
+  }
+
+  bool enabled() const { return rate > 0; }
+
+  // full bucket
+  void reset() {
+    tokens = burst;
+    last = MPI_Wtime();
+  }
+
+  void acquire(double bytes) {
+    if (rate <= 0)
+      return;
+
+    refill();
+    double need = std::min(bytes, burst);
+    if (tokens < need) {
+      std::this_thread::sleep_for(std::chrono::duration<double>
+				  ((need - tokens) / rate));
+      refill();
+    }
+    tokens -= bytes;
+  }
+
+private:
+  double rate;
+  double burst;
+  double tokens;
+  double last;
+
+  void refill() {
+    double now = MPI_Wtime();
+    tokens = std::min(burst, tokens + (now - last) * rate);
+    last = now;
+  }
+};
+
+#endif
@@ -0,0 +1,110 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Exposes the block-distributed output of sanders_permutation as a
+   Parallel BGL distributed property map, so PBGL algorithms can look up
+   the permuted label of any index without copying p_out.
+
+   Index k lives on rank k / m at offset k % m, with m = ceil(n/N) as in
+   sanders_permutation::permute. Remote lookups go through the ghost cells
+   of the distributed property map: request() the keys, synchronize(), and
+   get() then answers from the cache. The cache is unbounded: an evicted
+   value would make get() a blocking fetch that only completes while the
+   owner is inside a matching synchronize().
+*/
+
+#ifndef SANDERS_PERM_PROPERTY_MAP_HPP
+#define SANDERS_PERM_PROPERTY_MAP_HPP
+
+#include <cmath>
+#include <vector>
+#include <utility>
+
+#include <boost/graph/use_mpi.hpp>
+#include <boost/graph/distributed/mpi_process_group.hpp>
+#include <boost/property_map/property_map.hpp>
+#include <boost/property_map/parallel/distributed_property_map.hpp>
+
+// Maps an index to (owner rank, offset in the owner's block).
+template<typename perm_t>
+struct sp_block_global_map {
+  typedef perm_t key_type;
+  typedef std::pair<int, perm_t> value_type;
+  typedef value_type reference;
+  typedef boost::readable_property_map_tag category;
+
+  sp_block_global_map() : m(1) {}
+  explicit sp_block_global_map(perm_t pm) : m(pm) {}
+
+  perm_t m;
+};
+
+template<typename perm_t>
+inline std::pair<int, perm_t> 
+get(const sp_block_global_map<perm_t>& gm, perm_t k) {
+  return std::make_pair((int)(k / gm.m), k % gm.m);
+}
+
+
+template<typename perm_t, 
+	 typename process_group_t = boost::graph::distributed::mpi_process_group>
+struct sp_permutation_map {
+  typedef boost::iterator_property_map<
+    typename std::vector<perm_t>::iterator,
+    boost::typed_identity_property_map<perm_t> > storage_map;
+
+  typedef boost::parallel::distributed_property_map<
+    process_group_t, sp_block_global_map<perm_t>, storage_map> type;
+};
+
+// pg - process group over the ranks that called permute
+// n - number of permuted elements
+// p_out - this rank's output block; must not be resized while the map
+//         is in use
+template<typename perm_t, typename process_group_t>
+typename sp_permutation_map<perm_t, process_group_t>::type
+make_permutation_map(const process_group_t& pg, perm_t n,
+		     std::vector<perm_t>& p_out) {
+  typedef sp_permutation_map<perm_t, process_group_t> traits;
+
+  double j = (double)n/(double)num_processes(pg);
+  perm_t m = std::ceil(j);
+
+  // no index is ever looked up for n == 0, but the owner map divides by m
+  if (m == 0)
+    m = 1;
+
+  typename traits::storage_map storage(p_out.begin(), 
+				       boost::typed_identity_property_map<perm_t>());
+  typename traits::type pmap(pg, sp_block_global_map<perm_t>(m), storage);
+  // no eviction, PBGL bounds the ghost cells by default
+  pmap.set_max_ghost_cells(0);
+  return pmap;
+}
+
+#endif
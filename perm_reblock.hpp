@@ -0,0 +1,136 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Moving a block-distributed array to the block layout of another rank
+   count.
+
+   With N ranks, rank r holds elements [r*m, min((r+1)*m, n)) of an array
+   of n elements, m = ceil(n/N), as permute leaves p_out. reblock moves
+   such an array from N_old to N_new blocks. Every rank computes from the
+   two layouts alone what it sends to and receives from every other rank
+   (the overlaps of the old and new blocks), so one Alltoallv moves only
+   the elements that change owners and no counts are exchanged. Ranks
+   beyond the old or new rank count hold empty blocks; MPI_COMM_WORLD must
+   have at least max(N_old, N_new) ranks. If it does not, or an input 
+   block has the wrong size, every rank reports it and returns with out
+   unchanged.
+*/
+
+#ifndef SANDERS_PERM_REBLOCK_HPP
+#define SANDERS_PERM_REBLOCK_HPP
+
+#include <mpi.h>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "perm_error.hpp"
+
+// [first, last) - block of rank r when n elements are split over N ranks
+inline void sp_block_range(unsigned long n, int N, int r, 
+			   unsigned long& first, unsigned long& last) {
+  unsigned long m = (unsigned long)std::ceil((double)n/(double)N);
+  first = std::min((unsigned long)r * m, n);
+  last = (r < N) ? std::min(first + m, n) : first;
+}
+
+
+// in - this rank's block in the N_old layout, out - its block in the
+// N_new layout. Elements are sent as bytes, T must be trivially copyable.
+template<typename T>
+void reblock(unsigned long n, int N_old, int N_new, 
+	     const std::vector<T>& in, std::vector<T>& out) {
+  int N, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // both layouts must fit on the ranks; every rank returns if any input
+  // is wrong, the counts below assume it is not
+  int bad = 0, anybad = 0;
+  unsigned long ofirst = 0, olast = 0, nfirst = 0, nlast = 0;
+  if ((N_old < 1) || (N_new < 1) || (N < std::max(N_old, N_new))) {
+    sp_error("Reblock", "-", "Layouts of " + std::to_string(N_old) + 
+	     " and " + std::to_string(N_new) + " ranks do not fit on " +
+	     std::to_string(N) + " ranks");
+    bad = 1;
+  } else {
+    sp_block_range(n, N_old, rank, ofirst, olast);
+    sp_block_range(n, N_new, rank, nfirst, nlast);
+    if (in.size() != (olast - ofirst)) {
+      sp_error("Reblock", "-", "Input block has " + 
+	       std::to_string(in.size()) + " elements, expected " +
+	       std::to_string(olast - ofirst));
+      bad = 1;
+    }
+  }
+
+  if (MPI_Allreduce(&bad, &anybad, 1, MPI_INT, MPI_MAX, 
+		    MPI_COMM_WORLD) != 0)
+    sp_error("Reblock", "MPI_Allreduce", "Error agreeing on the input");
+  if (anybad)
+    return;
+
+  std::vector<int> sendcnts(N, 0), sdispls(N, 0);
+  std::vector<int> recvcnts(N, 0), rdispls(N, 0);
+  for (int rp=0; rp < N; ++rp) {
+    unsigned long f, l;
+    // my old block against rp's new block
+    sp_block_range(n, N_new, rp, f, l);
+    unsigned long sf = std::max(f, ofirst), sl = std::min(l, olast);
+    if (sf < sl) {
+      sendcnts[rp] = sl - sf;
+      sdispls[rp] = sf - ofirst;
+    }
+
+    // rp's old block against my new block
+    sp_block_range(n, N_old, rp, f, l);
+    unsigned long rf = std::max(f, nfirst), rl = std::min(l, nlast);
+    if (rf < rl) {
+      recvcnts[rp] = rl - rf;
+      rdispls[rp] = rf - nfirst;
+    }
+  }
+
+  MPI_Datatype type;
+  MPI_Type_contiguous(sizeof(T), MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+
+  // one spare element keeps &out[0] valid for empty blocks
+  out.resize(nlast - nfirst + 1);
+  if (MPI_Alltoallv((void*)(in.empty() ? NULL : &in[0]), &sendcnts[0], 
+		    &sdispls[0], type, &out[0], &recvcnts[0], &rdispls[0], 
+		    type, MPI_COMM_WORLD) != 0)
+    sp_error("Reblock", "MPI_Alltoallv", "Error moving the blocks");
+  out.resize(nlast - nfirst);
+
+  MPI_Type_free(&type);
+}
+
+#endif
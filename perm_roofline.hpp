@@ -0,0 +1,264 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Bandwidth efficiency (roofline) report for the permutation phases.
+
+   permute records the time of every phase and the bytes the phase moves
+   through memory and over the network. The byte counts follow a minimal
+   traffic model of the implementation: every array a phase touches is
+   counted once per pass over it (phase 1: generate, bucket and gather the
+   elements, send and receive them; phase 2: two reads and two writes per
+   swap; phase 3: read the shuffled elements and write the output block).
+   Network bytes are the bytes a rank sends to other ranks through MPI;
+   its own share and copies into a shared memory sink are left out, as
+   the network probes only measure traffic between ranks.
+
+   probe() measures the peaks the phases are compared with, on all ranks
+   at once so that ranks sharing a node also share its bandwidth:
+     - memory: best STREAM triad, a[i] = b[i] + s*c[i], 24 bytes/element
+     - network, all to all: best MPI_Alltoall, compared with phase 1
+     - network, point to point: best ping-pong between rank pairs, 
+       compared with phase 3
+   report() prints the achieved aggregate bandwidth of every phase and its
+   fraction of the aggregate peak on rank 0.
+*/
+
+#ifndef SANDERS_PERM_ROOFLINE_HPP
+#define SANDERS_PERM_ROOFLINE_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "perm_telemetry.hpp"
+#include "perm_error.hpp"
+
+#define SP_ROOFLINE_PHASES 3
+#define SP_ROOFLINE_REPEATS 5
+
+// per rank bandwidths in bytes/s, measured concurrently on all ranks
+struct sp_peaks {
+  double memory;
+  double alltoall;
+  double pingpong;
+};
+
+class sp_roofline {
+public:
+  sp_roofline() {
+    peak.memory = peak.alltoall = peak.pingpong = 0;
+    clear();
+  }
+
+  void clear() {
+    for (int p=0; p < SP_ROOFLINE_PHASES; ++p)
+      seconds[p] = memory_bytes[p] = network_bytes[p] = 0;
+  }
+
+  // called by permute; repeated calls accumulate
+  void record(sp_phase p, double secs, double mem, double net) {
+    seconds[p-1] += secs;
+    memory_bytes[p-1] += mem;
+    network_bytes[p-1] += net;
+  }
+
+  // Measures the peaks with buffers of about bytes per rank. Collective.
+  void probe(unsigned long bytes = (1UL << 26));
+
+  const sp_peaks& peaks() const { return peak; }
+
+  // Prints the report on rank 0. Collective.
+  void report() const;
+
+private:
+  sp_peaks peak;
+  double seconds[SP_ROOFLINE_PHASES];
+  double memory_bytes[SP_ROOFLINE_PHASES];
+  double network_bytes[SP_ROOFLINE_PHASES];
+
+  static double probe_memory(unsigned long bytes);
+  static double probe_alltoall(unsigned long bytes);
+  static double probe_pingpong(unsigned long bytes);
+};
+
+
+inline double 
+sp_roofline::probe_memory(unsigned long bytes) {
+  unsigned long len = std::max(bytes / (3*sizeof(double)), 1UL);
+  std::vector<double> a(len, 0), b(len, 1), c(len, 2);
+  const double s = 3;
+
+  double best = 0;
+  for (int k=0; k < SP_ROOFLINE_REPEATS; ++k) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    for (unsigned long i=0; i < len; ++i)
+      a[i] = b[i] + s*c[i];
+    double elapsed = MPI_Wtime() - start;
+    if (elapsed > 0)
+      best = std::max(best, (3*sizeof(double)*len) / elapsed);
+    // keeps the triad from being optimized away
+    b[k % len] = a[(k+1) % len];
+  }
+
+  return best;
+}
+
+
+inline double 
+sp_roofline::probe_alltoall(unsigned long bytes) {
+  int N;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  if (N < 2)
+    return 0;
+
+  int block = (int)std::max(bytes / N, 1UL);
+  std::vector<char> sendbuf((unsigned long)block*N, 1);
+  std::vector<char> recvbuf((unsigned long)block*N);
+
+  double best = 0;
+  for (int k=0; k < SP_ROOFLINE_REPEATS; ++k) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    if (MPI_Alltoall(&sendbuf[0], block, MPI_BYTE, &recvbuf[0], block, 
+		     MPI_BYTE, MPI_COMM_WORLD) != 0)
+      sp_error("Roofline", "MPI_Alltoall", "Error probing the network");
+    double elapsed = MPI_Wtime() - start, slowest;
+    MPI_Allreduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 
+		  MPI_COMM_WORLD);
+    if (slowest > 0)
+      best = std::max(best, ((double)block*(N-1)) / slowest);
+  }
+
+  return best;
+}
+
+
+inline double 
+sp_roofline::probe_pingpong(unsigned long bytes) {
+  int N, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  if (N < 2)
+    return 0;
+
+  // pairs (0, 1), (2, 3), ...; the last rank idles if N is odd
+  int partner = rank ^ 1;
+  int len = (int)std::max(bytes, 1UL);
+  std::vector<char> buf(len, 1);
+
+  double best = 0;
+  for (int k=0; k < SP_ROOFLINE_REPEATS; ++k) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = 0;
+    if (partner < N) {
+      double start = MPI_Wtime();
+      if (rank & 1) {
+	MPI_Recv(&buf[0], len, MPI_BYTE, partner, 0, MPI_COMM_WORLD, 
+		 MPI_STATUS_IGNORE);
+	MPI_Send(&buf[0], len, MPI_BYTE, partner, 0, MPI_COMM_WORLD);
+      } else {
+	MPI_Send(&buf[0], len, MPI_BYTE, partner, 0, MPI_COMM_WORLD);
+	MPI_Recv(&buf[0], len, MPI_BYTE, partner, 0, MPI_COMM_WORLD, 
+		 MPI_STATUS_IGNORE);
+      }
+      elapsed = MPI_Wtime() - start;
+    }
+
+    double slowest;
+    MPI_Allreduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 
+		  MPI_COMM_WORLD);
+    // one message each way per round trip
+    if (slowest > 0)
+      best = std::max(best, (2.0*len) / slowest);
+  }
+
+  return best;
+}
+
+
+inline void 
+sp_roofline::probe(unsigned long bytes) {
+  peak.memory = probe_memory(bytes);
+  peak.alltoall = probe_alltoall(bytes);
+  peak.pingpong = probe_pingpong(bytes);
+}
+
+
+inline void 
+sp_roofline::report() const {
+  int N, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  double maxsecs[SP_ROOFLINE_PHASES];
+  double totals[2*SP_ROOFLINE_PHASES], sums[2*SP_ROOFLINE_PHASES];
+  for (int p=0; p < SP_ROOFLINE_PHASES; ++p) {
+    totals[p] = memory_bytes[p];
+    totals[SP_ROOFLINE_PHASES+p] = network_bytes[p];
+  }
+
+  double peaks[3] = { peak.memory, peak.alltoall, peak.pingpong }, sumpeaks[3];
+
+  if ((MPI_Reduce((void*)seconds, maxsecs, SP_ROOFLINE_PHASES, MPI_DOUBLE, 
+		  MPI_MAX, 0, MPI_COMM_WORLD) != 0) ||
+      (MPI_Reduce(totals, sums, 2*SP_ROOFLINE_PHASES, MPI_DOUBLE, MPI_SUM, 
+		  0, MPI_COMM_WORLD) != 0) ||
+      (MPI_Reduce(peaks, sumpeaks, 3, MPI_DOUBLE, MPI_SUM, 0, 
+		  MPI_COMM_WORLD) != 0))
+    sp_error("Roofline", "MPI_Reduce", "Error summing the phase records");
+
+  if (rank != 0)
+    return;
+
+  std::cout << "[ROOFLINE] peaks (all ranks) : memory " 
+	    << sumpeaks[0]/1e9 << " GB/s, alltoall " << sumpeaks[1]/1e9 
+	    << " GB/s, ping-pong " << sumpeaks[2]/1e9 << " GB/s" << std::endl;
+
+  for (int p=0; p < SP_ROOFLINE_PHASES; ++p) {
+    double secs = maxsecs[p];
+    double mem = (secs > 0) ? sums[p]/secs : 0;
+    double net = (secs > 0) ? sums[SP_ROOFLINE_PHASES+p]/secs : 0;
+    double netpeak = (p == 0) ? sumpeaks[1] : sumpeaks[2];
+
+    std::cout << "[ROOFLINE] phase " << (p+1) << " : " << secs << " s"
+	      << ", memory " << mem/1e9 << " GB/s";
+    if (sumpeaks[0] > 0)
+      std::cout << " (" << 100*mem/sumpeaks[0] << "% of peak)";
+
+    if (p != 1) {
+      std::cout << ", network " << net/1e9 << " GB/s";
+      if (netpeak > 0)
+	std::cout << " (" << 100*net/netpeak << "% of peak)";
+    }
+    std::cout << std::endl;
+  }
+}
+
+#endif
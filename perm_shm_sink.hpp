@@ -0,0 +1,187 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Phase 3 sink with the output blocks of a node in shared memory.
+
+   The ranks of a node (MPI_COMM_TYPE_SHARED) allocate their output blocks
+   in one MPI shared memory window. In phase 3 a rank copies the ranges
+   for ranks of its own node straight into their blocks and adds the
+   number of values to the receiver's arrival counter, which lives in the
+   window next to the block; only ranges for other nodes go over MPI. 
+
+   The block stays in the window until the next begin or the destruction
+   of the sink; read it with data() and size(). Direct placement is used
+   by permute without frozen indices; with frozen indices ranges arrive as
+   messages as before.
+
+   The window stays in a passive target epoch (MPI_Win_lock_all) while it
+   exists; MPI_Win_sync orders the copies and counter updates with the
+   window under the separate memory model as well.
+
+   begin and the destructor are collective over the node, so the sink must
+   live on every rank and be destroyed before MPI_Finalize.
+*/
+
+#ifndef SANDERS_PERM_SHM_SINK_HPP
+#define SANDERS_PERM_SHM_SINK_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <iostream>
+
+#include "perm_sinks.hpp"
+#include "perm_error.hpp"
+
+// bytes in front of every block; the arrival counter is at the start
+#define SP_SHM_HEADER 64
+
+template<typename perm_t>
+class sp_shm_sink : public sp_output_sink<perm_t> {
+public:
+  sp_shm_sink() : window(MPI_WIN_NULL), count(0) {
+    int N, rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &N);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    own = rank;
+
+    if (MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+			    MPI_INFO_NULL, &node) != 0)
+      error("MPI_Comm_split_type", "Error creating the node communicator");
+
+    // node_rank[r] - rank of world rank r in node, -1 on other nodes
+    int nsize;
+    MPI_Comm_size(node, &nsize);
+    std::vector<int> members(nsize);
+    if (MPI_Allgather(&rank, 1, MPI_INT, &members[0], 1, MPI_INT, node) != 0)
+      error("MPI_Allgather", "Error exchanging the ranks of the node");
+
+    node_rank.assign(N, -1);
+    for (int k=0; k < nsize; ++k)
+      node_rank[members[k]] = k;
+    blocks.assign(nsize, NULL);
+  }
+
+  ~sp_shm_sink() {
+    release();
+    MPI_Comm_free(&node);
+  }
+
+  void begin(perm_t pos, unsigned int c);
+
+  perm_t* direct() {
+    return blocks[node_rank[own]];
+  }
+
+  perm_t* peer(int r) {
+    return (node_rank[r] < 0) ? NULL : blocks[node_rank[r]];
+  }
+
+  void deposited(int r, unsigned int c) {
+    // the copy is visible before the count
+    if (MPI_Win_sync(window) != 0)
+      error("MPI_Win_sync", "Error publishing a copied range");
+    __atomic_fetch_add(counter(node_rank[r]), (unsigned long)c, 
+		       __ATOMIC_RELEASE);
+  }
+
+  unsigned long arrivals() {
+    if (MPI_Win_sync(window) != 0)
+      error("MPI_Win_sync", "Error reading the arrival counter");
+    return __atomic_load_n(counter(node_rank[own]), __ATOMIC_ACQUIRE);
+  }
+
+  const perm_t* data() const { return blocks[node_rank[own]]; }
+  unsigned int size() const { return count; }
+
+private:
+  MPI_Comm node;
+  MPI_Win window;
+  std::vector<int> node_rank;
+  // blocks[k] - block of node rank k
+  std::vector<perm_t*> blocks;
+  unsigned int count;
+  int own;
+
+  // owns the window and the node communicator
+  sp_shm_sink(const sp_shm_sink&);
+  sp_shm_sink& operator=(const sp_shm_sink&);
+
+  void release() {
+    if (window == MPI_WIN_NULL)
+      return;
+    if (MPI_Win_unlock_all(window) != 0)
+      error("MPI_Win_unlock_all", "Error closing the access epoch");
+    MPI_Win_free(&window);
+  }
+
+  unsigned long* counter(int k) {
+    return (unsigned long*)((char*)blocks[k] - SP_SHM_HEADER);
+  }
+
+  void error(const std::string& mpifn, const std::string& desc) const {
+    sp_error("Shared memory sink", mpifn, desc);
+  }
+};
+
+
+template<typename perm_t>
+void 
+sp_shm_sink<perm_t>::begin(perm_t pos, unsigned int c) {
+  count = c;
+  release();
+
+  char* base;
+  MPI_Aint bytes = SP_SHM_HEADER + (MPI_Aint)c * sizeof(perm_t);
+  if (MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, node, &base, 
+			      &window) != 0)
+    error("MPI_Win_allocate_shared", "Error allocating the output blocks");
+
+  for (unsigned int k=0; k < blocks.size(); ++k) {
+    MPI_Aint size;
+    int unit;
+    char* b;
+    if (MPI_Win_shared_query(window, k, &size, &unit, &b) != 0)
+      error("MPI_Win_shared_query", "Error locating the block of a peer");
+    blocks[k] = (perm_t*)(b + SP_SHM_HEADER);
+  }
+
+  // peers access the blocks with loads, stores and atomics for the life
+  // of the window
+  if (MPI_Win_lock_all(MPI_MODE_NOCHECK, window) != 0)
+    error("MPI_Win_lock_all", "Error opening the access epoch");
+
+  *counter(node_rank[own]) = 0;
+  if (MPI_Win_sync(window) != 0)
+    error("MPI_Win_sync", "Error publishing the cleared counter");
+
+  // no peer deposits before every counter is cleared
+  if (MPI_Barrier(node) != 0)
+    error("MPI_Barrier", "Error synchronizing the node");
+}
+
+#endif
@@ -0,0 +1,118 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Output sinks for phase 3 of the permutation.
+
+   Phase 3 hands every range of the local output block to a sink as soon
+   as the range is final. Offsets are relative to the first index of the
+   block. A sink either exposes contiguous storage for the whole block
+   (direct), in which case phase 3 writes or receives into it and then
+   calls commit, or it receives the values through put. Sinks derive from
+   sp_output_sink and hide the hooks they need.
+
+   A sink whose storage is shared by the ranks of a node (peer) lets 
+   phase 3 copy the ranges of same-node ranks straight into their blocks
+   instead of sending them; the sender publishes each copy (deposited) and
+   the receiver counts what arrived that way (arrivals).
+*/
+
+#ifndef SANDERS_PERM_SINKS_HPP
+#define SANDERS_PERM_SINKS_HPP
+
+#include <vector>
+#include <cstddef>
+
+template<typename perm_t>
+class sp_output_sink {
+public:
+  // pos - first index of the block, count - size of the block
+  void begin(perm_t pos, unsigned int count) {}
+
+  // storage of the whole block, or NULL to receive values through put
+  perm_t* direct() { return NULL; }
+
+  // values of [off, off+count)
+  void put(unsigned int off, const perm_t* values, unsigned int count) {}
+
+  // [off, off+count) of the direct storage is final
+  void commit(unsigned int off, unsigned int count) {}
+
+  // the whole block is final
+  void end() {}
+
+  // storage of rank r's block if this rank can write it directly, or NULL
+  perm_t* peer(int r) { return NULL; }
+
+  // count values were copied into peer(r)
+  void deposited(int r, unsigned int count) {}
+
+  // number of values same-node ranks copied into this rank's block so far
+  unsigned long arrivals() { return 0; }
+};
+
+
+// Stores the block in a vector, the output of permute.
+template<typename perm_t>
+class sp_vector_sink : public sp_output_sink<perm_t> {
+public:
+  sp_vector_sink(std::vector<perm_t>& v) : out(v) {}
+
+  void begin(perm_t pos, unsigned int count) {
+    out.resize(count);
+  }
+
+  perm_t* direct() {
+    return out.data();
+  }
+
+private:
+  std::vector<perm_t>& out;
+};
+
+
+// Calls visitor(position, values, count) for every final range without
+// storing the block.
+template<typename perm_t, typename visitor_t>
+class sp_visitor_sink : public sp_output_sink<perm_t> {
+public:
+  sp_visitor_sink(visitor_t& v) : visitor(v), first(0) {}
+
+  void begin(perm_t pos, unsigned int count) {
+    first = pos;
+  }
+
+  void put(unsigned int off, const perm_t* values, unsigned int count) {
+    visitor(first + (perm_t)off, values, count);
+  }
+
+private:
+  visitor_t& visitor;
+  perm_t first;
+};
+
+#endif
@@ -0,0 +1,286 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Progress telemetry for long-running permutations.
+
+   Every rank keeps its counters (current phase, elements generated, bytes
+   sent and received) in an sp_progress record. With a segment name the
+   record lives in the POSIX shared memory segment "/<name>.<rank>", so a
+   monitor on the node can read it while the permutation runs (see 
+   sp_read_progress). The byte counters move as the exchanges progress:
+   per round in phase 1 (per paced round, or per pairwise round) and per
+   received range in phase 3. Phase 2 is a local shuffle; only its start
+   and end are published.
+
+   At every phase change, and after every paced phase 1 round, the ranks
+   also start nonblocking reductions of the counters to rank 0. poll()
+   completes them without blocking and rank 0 prints an aggregated
+   report, including the rank that reached the phase last, at most once
+   per reporting interval. Unpaced phase 1 is a single collective, so
+   rank 0 then reports only at phase changes.
+*/
+
+#ifndef SANDERS_PERM_TELEMETRY_HPP
+#define SANDERS_PERM_TELEMETRY_HPP
+
+#include <mpi.h>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "perm_error.hpp"
+
+enum sp_phase {
+  SP_PHASE_IDLE = 0,
+  SP_PHASE_1 = 1,
+  SP_PHASE_2 = 2,
+  SP_PHASE_3 = 3,
+  SP_PHASE_DONE = 4
+};
+
+struct sp_progress {
+  volatile unsigned long phase;
+  volatile unsigned long generated;
+  volatile unsigned long bytes_sent;
+  volatile unsigned long bytes_received;
+  // seconds since the permutation started
+  volatile double elapsed;
+};
+
+
+class sp_telemetry {
+public:
+  // shm_name - name of the shared memory segments, empty for none
+  // interval - minimum seconds between reports on rank 0, negative for
+  //            no reports
+  sp_telemetry(const std::string& shm_name = "", double interval = 0)
+    : name(shm_name), report_interval(interval), last_report(-1),
+      progress(&local), rank(-1) {
+    clear();
+  }
+
+  ~sp_telemetry() {
+    finish();
+    if (progress != &local) {
+      munmap(progress, sizeof(sp_progress));
+      shm_unlink(segment().c_str());
+    }
+  }
+
+  // called by permute on every rank before phase 1
+  void start(int r) {
+    finish();
+    if ((rank != r) && !name.empty()) {
+      rank = r;
+      map_segment();
+    }
+
+    rank = r;
+    clear();
+    start_time = MPI_Wtime();
+    last_report = -1;
+  }
+
+  // also starts the reduction that reports the new phase on rank 0
+  void set_phase(sp_phase p) {
+    progress->phase = p;
+    checkpoint();
+  }
+
+  // starts a reduction of the current counters to rank 0; all ranks must
+  // call it at the same points, e.g. after every paced round
+  void checkpoint() {
+    touch();
+    reduce();
+    poll();
+  }
+
+  void add_generated(unsigned long c) { progress->generated += c; }
+  void add_sent(unsigned long bytes) { progress->bytes_sent += bytes; }
+  void add_received(unsigned long bytes) { progress->bytes_received += bytes; }
+
+  const sp_progress& counters() const { return *progress; }
+
+  // completes finished reductions, never blocks
+  void poll() {
+    touch();
+    while (!pending.empty()) {
+      int done = 0;
+      MPI_Testall(2, pending.front().requests, &done, MPI_STATUSES_IGNORE);
+      if (!done)
+	break;
+      report(pending.front());
+      pending.pop_front();
+    }
+  }
+
+  // completes all outstanding reductions
+  void finish() {
+    while (!pending.empty()) {
+      MPI_Waitall(2, pending.front().requests, MPI_STATUSES_IGNORE);
+      report(pending.front());
+      pending.pop_front();
+    }
+  }
+
+private:
+  struct double_int {
+    double value;
+    int rank;
+  };
+
+  struct reduction {
+    unsigned long phase;
+    unsigned long sendbuf[3];
+    unsigned long recvbuf[3];
+    double_int sendlast;
+    double_int recvlast;
+    MPI_Request requests[2];
+  };
+
+  std::string name;
+  double report_interval;
+  double last_report;
+  double start_time;
+  sp_progress local;
+  sp_progress* progress;
+  int rank;
+  std::deque<reduction> pending;
+
+  // the counters may live in a mapped segment
+  sp_telemetry(const sp_telemetry&);
+  sp_telemetry& operator=(const sp_telemetry&);
+
+  std::string segment() const {
+    std::ostringstream s;
+    s << "/" << name << "." << rank;
+    return s.str();
+  }
+
+  void clear() {
+    progress->phase = SP_PHASE_IDLE;
+    progress->generated = 0;
+    progress->bytes_sent = 0;
+    progress->bytes_received = 0;
+    progress->elapsed = 0;
+  }
+
+  void touch() {
+    progress->elapsed = MPI_Wtime() - start_time;
+  }
+
+  void map_segment() {
+    int fd = shm_open(segment().c_str(), O_CREAT | O_RDWR, 0644);
+    if ((fd < 0) || (ftruncate(fd, sizeof(sp_progress)) != 0)) {
+      sp_error("Telemetry", "shm_open", 
+	       "Cannot create shared memory segment " + segment(), "function");
+      if (fd >= 0)
+	close(fd);
+      return;
+    }
+
+    void* p = mmap(NULL, sizeof(sp_progress), PROT_READ | PROT_WRITE, 
+		   MAP_SHARED, fd, 0);
+    close(fd);
+    if (p != MAP_FAILED)
+      progress = (sp_progress*)p;
+  }
+
+  void reduce() {
+    if (report_interval < 0)
+      return;
+
+    pending.push_back(reduction());
+    reduction& red = pending.back();
+    red.phase = progress->phase;
+    red.sendbuf[0] = progress->generated;
+    red.sendbuf[1] = progress->bytes_sent;
+    red.sendbuf[2] = progress->bytes_received;
+    red.sendlast.value = progress->elapsed;
+    red.sendlast.rank = rank;
+
+    if (MPI_Ireduce(red.sendbuf, red.recvbuf, 3, MPI_UNSIGNED_LONG, MPI_SUM, 
+		    0, MPI_COMM_WORLD, &red.requests[0]) != 0)
+      sp_error("Telemetry", "MPI_Ireduce", "Error summing the counters");
+
+    if (MPI_Ireduce(&red.sendlast, &red.recvlast, 1, MPI_DOUBLE_INT, 
+		    MPI_MAXLOC, 0, MPI_COMM_WORLD, &red.requests[1]) != 0)
+      sp_error("Telemetry", "MPI_Ireduce", "Error finding the last rank");
+  }
+
+  void report(const reduction& red) {
+    if (rank != 0)
+      return;
+
+    double now = MPI_Wtime() - start_time;
+    if ((red.phase != SP_PHASE_DONE) && (last_report >= 0) && 
+	((now - last_report) < report_interval))
+      return;
+
+    last_report = now;
+    std::cout << "[PROGRESS] t=" << now << "s, all ranks reached phase "
+	      << red.phase << ", generated : " << red.recvbuf[0]
+	      << ", bytes sent : " << red.recvbuf[1]
+	      << ", bytes received : " << red.recvbuf[2]
+	      << ", last rank : " << red.recvlast.rank
+	      << " (at t=" << red.recvlast.value << "s)"
+	      << std::endl;
+  }
+};
+
+
+// Reads the counters a rank publishes under the given segment name.
+inline bool sp_read_progress(const std::string& shm_name, int rank,
+			     sp_progress& out) {
+  std::ostringstream s;
+  s << "/" << shm_name << "." << rank;
+  int fd = shm_open(s.str().c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+
+  void* p = mmap(NULL, sizeof(sp_progress), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  const sp_progress* src = (const sp_progress*)p;
+  out.phase = src->phase;
+  out.generated = src->generated;
+  out.bytes_sent = src->bytes_sent;
+  out.bytes_received = src->bytes_received;
+  out.elapsed = src->elapsed;
+  munmap(p, sizeof(sp_progress));
+  return true;
+}
+
+#endif
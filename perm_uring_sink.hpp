@@ -0,0 +1,426 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Phase 3 sink that writes the output block to a file with io_uring.
+
+   Every rank writes its block, in order, to "<path>.<rank>". The block is
+   cut into pages of SP_URING_PAGE bytes, staged in aligned buffers; as
+   soon as phase 3 has delivered a whole page, its write is queued on an
+   io_uring, so the disk works while phase 3 is still receiving. end()
+   waits for the outstanding writes and trims the padding of the last 
+   page. The ring is driven with the raw system calls, no liburing.
+
+   The file is opened with O_DIRECT when the file system allows it and 
+   with buffered I/O otherwise. Without io_uring (old kernels, seccomp),
+   pages are written with pwrite as they complete.
+*/
+
+#ifndef SANDERS_PERM_URING_SINK_HPP
+#define SANDERS_PERM_URING_SINK_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "perm_sinks.hpp"
+#include "perm_error.hpp"
+
+// bytes per staged page, a multiple of SP_URING_ALIGN
+#define SP_URING_PAGE (1 << 16)
+// O_DIRECT alignment of buffers, offsets and lengths
+#define SP_URING_ALIGN 4096
+#define SP_URING_DEPTH 64
+
+template<typename perm_t>
+class sp_uring_sink : public sp_output_sink<perm_t> {
+public:
+  // path - prefix of the output file of every rank
+  // direct - try O_DIRECT first
+  sp_uring_sink(const std::string& path, bool direct = true)
+    : prefix(path), try_direct(direct), fd(-1), ring_fd(-1), inflight(0) {}
+
+  ~sp_uring_sink() {
+    // the kernel may still read from buffers of writes in flight
+    while ((ring_fd >= 0) && (inflight > 0) && reap(1))
+      ;
+    close_ring();
+    if (fd >= 0)
+      close(fd);
+    for (unsigned long p=0; p < pages.size(); ++p)
+      free(pages[p]);
+    for (unsigned int k=0; k < pool.size(); ++k)
+      free(pool[k]);
+  }
+
+  void begin(perm_t pos, unsigned int count);
+
+  void put(unsigned int off, const perm_t* values, unsigned int count);
+
+  void end();
+
+  // name of this rank's file
+  std::string file_name() const {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    std::ostringstream s;
+    s << prefix << "." << rank;
+    return s.str();
+  }
+
+private:
+  std::string prefix;
+  bool try_direct;
+  bool odirect;
+  int fd;
+  unsigned long bytes;
+  std::vector<char*> pages;
+  std::vector<unsigned int> filled;
+  std::vector<char*> pool;
+
+  // ring state
+  int ring_fd;
+  unsigned int inflight;
+  unsigned int entries;
+  void* sq_ptr;
+  void* cq_ptr;
+  std::size_t sq_size;
+  std::size_t cq_size;
+  io_uring_sqe* sqes;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  io_uring_cqe* cqes;
+
+  // not copyable, owns the file, the ring and the buffers
+  sp_uring_sink(const sp_uring_sink&);
+  sp_uring_sink& operator=(const sp_uring_sink&);
+
+  void error(const std::string& fn, const std::string& desc) const {
+    sp_error("Uring sink", fn, desc, "function");
+  }
+
+  unsigned long page_bytes(unsigned long p) const {
+    return std::min((unsigned long)SP_URING_PAGE, bytes - p*SP_URING_PAGE);
+  }
+
+  char* get_buffer() {
+    if (!pool.empty()) {
+      char* b = pool.back();
+      pool.pop_back();
+      return b;
+    }
+    void* b = NULL;
+    if (posix_memalign(&b, SP_URING_ALIGN, SP_URING_PAGE) != 0)
+      return NULL;
+    return (char*)b;
+  }
+
+  bool open_ring();
+  void close_ring();
+  void submit(unsigned long p);
+  bool reap(unsigned int wait);
+  void fall_back();
+  void write_sync(unsigned long p, unsigned long done);
+};
+
+
+template<typename perm_t>
+bool 
+sp_uring_sink<perm_t>::open_ring() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd = syscall(__NR_io_uring_setup, SP_URING_DEPTH, &params);
+  if (ring_fd < 0)
+    return false;
+
+  entries = params.sq_entries;
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single)
+    sq_size = cq_size = std::max(sq_size, cq_size);
+
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, 
+		MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  cq_ptr = single ? sq_ptr : 
+    mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	 ring_fd, IORING_OFF_CQ_RING);
+  sqes = (io_uring_sqe*)mmap(NULL, entries * sizeof(io_uring_sqe), 
+			     PROT_READ | PROT_WRITE, 
+			     MAP_SHARED | MAP_POPULATE, ring_fd, 
+			     IORING_OFF_SQES);
+  if ((sq_ptr == MAP_FAILED) || (cq_ptr == MAP_FAILED) || 
+      (sqes == MAP_FAILED)) {
+    close(ring_fd);
+    ring_fd = -1;
+    return false;
+  }
+
+  char* sq = (char*)sq_ptr;
+  char* cq = (char*)cq_ptr;
+  sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+  sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+  sq_array = (unsigned int*)(sq + params.sq_off.array);
+  cq_head = (unsigned int*)(cq + params.cq_off.head);
+  cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+  cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+  cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+  return true;
+}
+
+
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::close_ring() {
+  if (ring_fd < 0)
+    return;
+
+  munmap(sqes, entries * sizeof(io_uring_sqe));
+  if (cq_ptr != sq_ptr)
+    munmap(cq_ptr, cq_size);
+  munmap(sq_ptr, sq_size);
+  close(ring_fd);
+  ring_fd = -1;
+}
+
+
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::begin(perm_t pos, unsigned int count) {
+  bytes = (unsigned long)count * sizeof(perm_t);
+  unsigned long npages = (bytes + SP_URING_PAGE - 1) / SP_URING_PAGE;
+  pages.assign(npages, NULL);
+  filled.assign(npages, 0);
+
+  std::string name = file_name();
+  odirect = false;
+  fd = -1;
+  if (try_direct) {
+    fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    odirect = (fd >= 0);
+  }
+  if (fd < 0)
+    fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    error("open", "Cannot create " + name);
+
+  if ((ring_fd < 0) && !open_ring())
+    error("io_uring_setup", "io_uring not available, writing with pwrite");
+}
+
+
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::put(unsigned int off, const perm_t* values,
+			   unsigned int count) {
+  const char* src = (const char*)values;
+  unsigned long first = (unsigned long)off * sizeof(perm_t);
+  unsigned long last = first + (unsigned long)count * sizeof(perm_t);
+
+  while (first < last) {
+    unsigned long p = first / SP_URING_PAGE;
+    unsigned long poff = first - p*SP_URING_PAGE;
+    unsigned long len = std::min(last - first, SP_URING_PAGE - poff);
+
+    if (pages[p] == NULL)
+      pages[p] = get_buffer();
+    memcpy(pages[p] + poff, src, len);
+    filled[p] += len;
+    if (filled[p] == page_bytes(p))
+      submit(p);
+
+    src += len;
+    first += len;
+  }
+}
+
+
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::submit(unsigned long p) {
+  unsigned long len = page_bytes(p);
+  // O_DIRECT writes whole aligned sectors; end() trims the padding
+  if (odirect && (len % SP_URING_ALIGN)) {
+    unsigned long padded = (len + SP_URING_ALIGN - 1) / SP_URING_ALIGN 
+      * SP_URING_ALIGN;
+    memset(pages[p] + len, 0, padded - len);
+    len = padded;
+  }
+
+  while ((ring_fd >= 0) && (inflight == entries))
+    if (!reap(1))
+      fall_back();
+
+  // fall_back may have written it already
+  if (pages[p] == NULL)
+    return;
+
+  if ((ring_fd < 0) || (fd < 0)) {
+    write_sync(p, 0);
+    return;
+  }
+
+  unsigned int tail = *sq_tail;
+  unsigned int idx = tail & *sq_mask;
+  io_uring_sqe* sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)pages[p];
+  sqe->len = len;
+  sqe->off = p * SP_URING_PAGE;
+  sqe->user_data = p;
+  sq_array[idx] = idx;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, NULL, 0) < 1) {
+    error("io_uring_enter", "Cannot submit write, writing with pwrite");
+    fall_back();
+    return;
+  }
+  ++inflight;
+}
+
+
+// completes finished writes, waiting for at least wait of them; false if
+// the ring cannot wait any more
+template<typename perm_t>
+bool 
+sp_uring_sink<perm_t>::reap(unsigned int wait) {
+  if (wait && (syscall(__NR_io_uring_enter, ring_fd, 0, wait, 
+		       IORING_ENTER_GETEVENTS, NULL, 0) < 0)) {
+    error("io_uring_enter", "Error waiting for writes");
+    return false;
+  }
+
+  unsigned int head = *cq_head;
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    io_uring_cqe* cqe = &cqes[head & *cq_mask];
+    unsigned long p = cqe->user_data;
+    int res = cqe->res;
+    ++head;
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    --inflight;
+
+    if (res < 0) {
+      error("io_uring write", strerror(-res));
+      write_sync(p, 0);
+    } else {
+      // short writes finish synchronously
+      write_sync(p, res);
+    }
+  }
+
+  return true;
+}
+
+
+// Drops the ring after completing the writes it can still report. Every
+// page that is complete but not released, the unsubmitted one and any
+// whose write state is unknown, is then written with pwrite; rewriting a
+// page that did reach the file stores the same bytes again.
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::fall_back() {
+  while ((inflight > 0) && reap(1))
+    ;
+  close_ring();
+  inflight = 0;
+
+  for (unsigned long p=0; p < pages.size(); ++p)
+    if ((pages[p] != NULL) && (filled[p] == page_bytes(p)))
+      write_sync(p, 0);
+}
+
+
+// writes page p from byte done on, then releases its buffer
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::write_sync(unsigned long p, unsigned long done) {
+  unsigned long len = page_bytes(p);
+  if (odirect)
+    len = (len + SP_URING_ALIGN - 1) / SP_URING_ALIGN * SP_URING_ALIGN;
+
+  while ((fd >= 0) && (done < len)) {
+    // O_DIRECT needs aligned offsets; the bytes before are written again
+    if (odirect)
+      done = done / SP_URING_ALIGN * SP_URING_ALIGN;
+
+    ssize_t w = pwrite(fd, pages[p] + done, len - done, 
+		       p*SP_URING_PAGE + done);
+    if (w <= 0) {
+      error("pwrite", strerror(errno));
+      break;
+    }
+    done += w;
+  }
+
+  pool.push_back(pages[p]);
+  pages[p] = NULL;
+}
+
+
+template<typename perm_t>
+void 
+sp_uring_sink<perm_t>::end() {
+  while ((ring_fd >= 0) && (inflight > 0))
+    if (!reap(1))
+      fall_back();
+
+  // pages phase 3 never completed
+  for (unsigned long p=0; p < pages.size(); ++p)
+    if (pages[p] != NULL) {
+      error("end", "Output page incomplete");
+      pool.push_back(pages[p]);
+      pages[p] = NULL;
+    }
+
+  if (fd >= 0) {
+    if (ftruncate(fd, bytes) != 0)
+      error("ftruncate", strerror(errno));
+    close(fd);
+    fd = -1;
+  }
+}
+
+#endif
@@ -0,0 +1,179 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Wait time attribution for the collectives of the permutation.
+
+   sanders_permutation (permute, permute_into, assign_random_ranks,
+   reshuffle) and sanders_split timestamp the entry and exit of every
+   collective they call on MPI_COMM_WORLD, including the ones inside
+   sp_exchange_grouped. Point-to-point calls (phase 3 messages, butterfly
+   and pairwise rounds) are not recorded; their waits show up in the
+   barrier that closes the phase. cycle_structure, reblock and
+   valiant_router take no profile.
+
+   All ranks call the collectives in the same order, so the k-th record
+   of every rank belongs to the same call. The clocks of the ranks need
+   not agree: a collective cannot complete before its last rank arrives,
+   so the rank that spends the least time inside it is the one that
+   arrived last (the straggler), and every other rank waited for the
+   difference. Calls that do not synchronize fully (MPI_Scan) are
+   attributed the same way.
+
+   report() gathers the records on rank 0 and prints, for every call and
+   for every phase, the straggler, the total time the other ranks waited
+   and the rank that waited longest.
+*/
+
+#ifndef SANDERS_PERM_WAIT_PROFILE_HPP
+#define SANDERS_PERM_WAIT_PROFILE_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <iostream>
+
+#include "perm_telemetry.hpp"
+#include "perm_error.hpp"
+
+class sp_wait_profile {
+public:
+  void clear() {
+    events.clear();
+  }
+
+  // called by the permutation just before a collective
+  void enter(sp_phase p, const char* name) {
+    event e;
+    e.phase = p;
+    e.name = name;
+    e.duration = 0;
+    events.push_back(e);
+    entered = MPI_Wtime();
+  }
+
+  // called by the permutation just after the collective returns
+  void exit() {
+    events.back().duration = MPI_Wtime() - entered;
+  }
+
+  // Prints the report on rank 0. Collective.
+  void report() const;
+
+private:
+  struct event {
+    sp_phase phase;
+    const char* name;
+    double duration;
+  };
+
+  std::vector<event> events;
+  double entered;
+};
+
+
+inline void 
+sp_wait_profile::report() const {
+  int N, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  // every rank has to report the same calls
+  int mine = events.size(), E;
+  if (MPI_Allreduce(&mine, &E, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD) != 0)
+    sp_error("Wait profile", "MPI_Allreduce", "Error counting the calls");
+  if ((E != mine) && (rank == 0))
+    sp_error("Wait profile", "-", "Ranks recorded different numbers of "
+	     "collectives, reporting the first " + std::to_string(E));
+
+  std::vector<double> durations(E);
+  for (int k=0; k < E; ++k)
+    durations[k] = events[k].duration;
+
+  // all[r*E + k] - duration of call k on rank r
+  std::vector<double> all(rank == 0 ? (unsigned long)N*E : 1);
+  if (MPI_Gather(E ? &durations[0] : NULL, E, MPI_DOUBLE, &all[0], E, 
+		 MPI_DOUBLE, 0, MPI_COMM_WORLD) != 0)
+    sp_error("Wait profile", "MPI_Gather", "Error gathering the durations");
+
+  if (rank != 0)
+    return;
+
+  // per phase: wait of every rank, number of calls every rank arrived last
+  std::vector<double> waits((SP_PHASE_DONE+1)*N, 0);
+  std::vector<int> last((SP_PHASE_DONE+1)*N, 0);
+
+  for (int k=0; k < E; ++k) {
+    int straggler = 0;
+    for (int r=1; r < N; ++r)
+      if (all[r*E+k] < all[straggler*E+k])
+	straggler = r;
+
+    double total = 0, worst = 0;
+    int waiter = straggler;
+    for (int r=0; r < N; ++r) {
+      double w = all[r*E+k] - all[straggler*E+k];
+      total += w;
+      if (w > worst) {
+	worst = w;
+	waiter = r;
+      }
+    }
+
+    int p = events[k].phase;
+    for (int r=0; r < N; ++r)
+      waits[p*N+r] += all[r*E+k] - all[straggler*E+k];
+    ++last[p*N+straggler];
+
+    std::cout << "[WAIT] phase " << p << ", " << events[k].name
+	      << " : last rank " << straggler << ", total wait " << total
+	      << " s, longest wait " << worst << " s (rank " << waiter << ")"
+	      << std::endl;
+  }
+
+  for (int p=0; p <= SP_PHASE_DONE; ++p) {
+    int straggler = -1, waiter = -1;
+    double total = 0;
+    for (int r=0; r < N; ++r) {
+      total += waits[p*N+r];
+      if (last[p*N+r] && ((straggler < 0) || 
+			  (last[p*N+r] > last[p*N+straggler])))
+	straggler = r;
+      if ((waiter < 0) || (waits[p*N+r] > waits[p*N+waiter]))
+	waiter = r;
+    }
+
+    if (straggler < 0)
+      continue;
+
+    std::cout << "[WAIT] phase " << p << " total : wait " << total
+	      << " s, last most often : rank " << straggler << " ("
+	      << last[p*N+straggler] << " calls), longest wait : rank " 
+	      << waiter << " (" << waits[p*N+waiter] << " s)" << std::endl;
+  }
+}
+
+#endif
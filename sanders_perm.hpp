@@ -36,61 +36,243 @@ external and hierarchical memory." Information Processing Letters 67.6 (1998): 3
 Random Permutations with MPI." ACM Transactions on Mathematical Software (TOMS) 41.1 (2014): 5.
 */
 
+#ifndef SANDERS_PERM_HPP
+#define SANDERS_PERM_HPP
+
 #include <mpi.h>
 #include <cmath>
 #include <vector>
+#include <string>
 #include <algorithm>
+#include <cstdlib>
+#include <thread>
 
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+
+#include "local_shuffle.hpp"
+#include "sanders_rng.hpp"
+#include "perm_telemetry.hpp"
+#include "perm_roofline.hpp"
+#include "perm_wait_profile.hpp"
+#include "perm_pacing.hpp"
+#include "perm_sinks.hpp"
+#include "perm_exchange.hpp"
+#include "perm_error.hpp"
 
 #define SP_DATA_TYPE MPI_UNSIGNED_LONG
 
-template<typename perm_t>
+#include "butterfly_exchange.hpp"
+
+// how phase 1 moves the elements
+enum sp_exchange_strategy {
+  // random destinations, one Alltoallv
+  SP_ALLTOALLV,
+  // log2(N) pairwise rounds ending in balanced blocks; falls back to
+  // SP_ALLTOALLV if N is not a power of two
+  SP_BUTTERFLY,
+  // random destinations like SP_ALLTOALLV, but exchanged in N-1 rounds in
+  // which every rank sends to and receives from one partner (rank XOR k
+  // for N a power of two, rank +/- k otherwise), with at most
+  // SP_PAIRWISE_WINDOW rounds in flight, so no rank is hit by all others
+  // at once
+  SP_PAIRWISE
+};
+
+// rounds of SP_PAIRWISE in flight
+#define SP_PAIRWISE_WINDOW 4
+// empty polls in phase 3 before the rank yields its core between polls
+#define SP_PHASE3_SPINS 64
+
+// rng_t - random number policy, see sanders_rng.hpp
+template<typename perm_t, typename rng_t = sp_mt19937_rng>
 class sanders_permutation {
 
   typedef std::vector<perm_t> permute_vector_t;
 
 public:
   // n - number to permute
-  sanders_permutation(perm_t& pn):n(pn) {}
+  // g - random number generator, e.g. a keyed sp_aes_ctr_rng
+  sanders_permutation(perm_t& pn, const rng_t& g = rng_t()):n(pn), 
+	gen(g),
+	seed_value(SP_DEFAULT_SEED),
+	engine(SP_FISHER_YATES),
+	calibration_loaded(false),
+	nthreads(std::thread::hardware_concurrency()),
+	exchange(SP_ALLTOALLV),
+	telemetry(NULL),
+	roofline(NULL),
+	waits(NULL),
+	pacing_chunk(SP_PACING_CHUNK),
+	remote(0) {}
+
+  // strategy for the phase 1 exchange of the next calls to permute
+  void set_exchange(sp_exchange_strategy s) {
+    exchange = s;
+  }
+
+  // t - progress counters updated by the next calls to permute, NULL for
+  //     none; must be set on all ranks or on none
+  void set_telemetry(sp_telemetry* t) {
+    telemetry = t;
+  }
+
+  // r - accumulates the time and bytes moved of every phase of the next 
+  //     calls to permute, NULL for none; see perm_roofline.hpp
+  void set_roofline(sp_roofline* r) {
+    roofline = r;
+  }
+
+  // w - records entry and exit of every collective of the next calls to
+  //     permute, NULL for none; must be set on all ranks or on none, see
+  //     perm_wait_profile.hpp
+  void set_wait_profile(sp_wait_profile* w) {
+    waits = w;
+  }
+
+  // bytes_per_second - cap on the bytes every rank sends in phases 1 and 3
+  //                    of the next calls to permute, 0 for none
+  // chunk - bytes per paced chunk
+  // Capped runs exchange phase 1 in rounds of at most chunk bytes per rank
+  // with the Alltoallv strategy, and split phase 3 ranges into chunks.
+  // The cap picks the collectives of phase 1, so it must be set on all 
+  // ranks or on none; rates and chunks may differ, the ranks agree on the
+  // number of rounds.
+  void set_bandwidth_cap(double bytes_per_second, 
+			 unsigned long chunk = SP_PACING_CHUNK) {
+    pacing_chunk = std::max(chunk, 1UL);
+    pacer.configure(bytes_per_second, pacing_chunk);
+  }
+
+  // seed for the next calls to permute; rank r draws from stream r
+  void set_seed(unsigned long s) {
+    seed_value = s;
+  }
+
+  // engine - local shuffle for the next calls to permute
+  // threads - number of threads used by the dart-throwing engine
+  // SP_PHASE2_AUTO reads the calibration table from the file named by the
+  // SP_PHASE2_CALIBRATION environment variable, or SP_PHASE2_CALIBRATION_FILE,
+  // unless set_phase2_calibration provided one.
+  void set_phase2_engine(sp_phase2_engine e, unsigned int threads = 0) {
+    engine = e;
+    if (threads > 0)
+      nthreads = threads;
+  }
+
+  // table - kernel choices for SP_PHASE2_AUTO, see the calibrate tool
+  void set_phase2_calibration(const sp_phase2_calibration& table) {
+    calibration = table;
+    calibration_loaded = true;
+  }
 
   //  N - total number of processors
   void permute(int N, permute_vector_t& p_out);
 
+  //  frozen - indices of this rank's input block that must map to 
+  //  themselves; the other indices are permuted among the other positions.
+  //  Every rank has to call this overload.
+  void permute(int N, permute_vector_t& p_out, 
+	       const permute_vector_t& frozen);
+
+  //  visitor - called as visitor(position, values, count) for every range
+  //  of this rank's output block as soon as it is final; the output block
+  //  is never stored
+  template<typename visitor_t>
+  void permute_visit(int N, visitor_t& visitor);
+
+  //  sink - receives this rank's output block, see perm_sinks.hpp
+  template<typename sink_t>
+  void permute_into(int N, sink_t& sink);
+
+  template<typename sink_t>
+  void permute_into(int N, sink_t& sink, const permute_vector_t& frozen);
+
+  //  local_count - number of items on this rank, any count per rank
+  //  ranks_out - ranks_out[i] is the random rank in [0, total) of local 
+  //  item i, total being the sum of local_count over all ranks; the ranks
+  //  of all items form a uniform random permutation. n is not used.
+  void assign_random_ranks(int N, unsigned int local_count,
+			   permute_vector_t& ranks_out);
+
+  //  fraction - share of the n positions to re-randomize
+  //  p_out - this rank's block of an existing permutation, as left by
+  //  permute; round(fraction*n) uniformly chosen positions get their
+  //  values permuted uniformly among themselves, the others keep theirs.
+  //  Only the chosen values are exchanged.
+  void reshuffle(int N, double fraction, permute_vector_t& p_out);
+
   void verify(int N, permute_vector_t& p_out);
 
 private:
   perm_t& n;
   int rank;
+  rng_t gen;
+  unsigned long seed_value;
+  sp_phase2_engine engine;
+  sp_phase2_calibration calibration;
+  bool calibration_loaded;
+  unsigned int nthreads;
+  sp_exchange_strategy exchange;
+  sp_telemetry* telemetry;
+  sp_roofline* roofline;
+  sp_wait_profile* waits;
+  sp_token_bucket pacer;
+  unsigned long pacing_chunk;
+  // elements the last phase 1 or phase 3 sent to other ranks over MPI
+  unsigned long remote;
 
 #ifdef PRINT_DEBUG
   int debug_rank;
 #endif
 
   void error(std::string mpifn, std::string desc) {
-    std::cout << "[ERROR] Permuting numbers -- MPI function : "
-	      << mpifn << ", description : " << desc
-	      << std::endl;
+    sp_error("Permuting numbers", mpifn, desc);
   }
 
-  void run_phase1(unsigned int count, perm_t pos, unsigned int N, 
-		  perm_t** temp, unsigned int& total);
+  template<typename sink_t>
+  void run_permute(int N, sink_t& sink,
+		   const permute_vector_t& frozen, bool constrained);
+  void run_phase1(unsigned int blockcount, perm_t pos, 
+		  const permute_vector_t& frozen, unsigned int N, 
+		  perm_t** temp, unsigned int& total,
+		  const perm_t* values = NULL);
+  void run_phase1_butterfly(unsigned int blockcount, perm_t pos, 
+			    const permute_vector_t& frozen, unsigned int N, 
+			    const std::vector<perm_t>& bounds,
+			    perm_t** temp, unsigned int& total);
+  void run_pairwise_exchange(const perm_t* sendbuf, 
+			     const std::vector<int>& sendcnts,
+			     const std::vector<int>& sdispls,
+			     perm_t* recvbuf,
+			     const std::vector<int>& recvcnts,
+			     const std::vector<int>& rdispls,
+			     unsigned int N);
   void run_phase2(perm_t** temp, unsigned int total);
+  template<typename sink_t>
   void run_phase3(perm_t* temp, unsigned int size, 
-		  unsigned int m, 
+		  const std::vector<perm_t>& bounds,
 		  perm_t pos,
 		  unsigned int count,
-		  permute_vector_t& perm);
+		  const permute_vector_t& frozen,
+		  bool constrained,
+		  sink_t& sink);
+  template<typename sink_t>
+  void emit(sink_t& sink, unsigned int off, const perm_t* values, 
+	    unsigned int count);
+  template<typename sink_t>
+  void place(sink_t& sink, const std::vector<unsigned int>& slots,
+	     unsigned int freeoff, const perm_t* values, unsigned int count);
 
 };
 
 
 #define SANDERS_PERM_PARAMS \
-  typename perm_t
+  typename perm_t, typename rng_t
 
 #define SANDERS_PERM_TYPE \
-  sanders_permutation<perm_t>
+  sanders_permutation<perm_t, rng_t>
 
 template<SANDERS_PERM_PARAMS>
 void 
@@ -106,6 +288,278 @@ SANDERS_PERM_TYPE::verify(int N, permute_vector_t& p_out) {
 template<SANDERS_PERM_PARAMS>
 void 
 SANDERS_PERM_TYPE::permute(int N, permute_vector_t& p_out) {
+  sp_vector_sink<perm_t> sink(p_out);
+  permute_vector_t frozen;
+  run_permute(N, sink, frozen, false);
+
+#ifdef PRINT_DEBUG
+  if (rank == debug_rank) {
+    std::cout << "@Rank " << rank << std::endl;
+    for(unsigned int q=0; q < p_out.size(); ++q) {
+      std::cout << p_out[q] << ",";
+    }
+
+    std::cout << std::endl;
+  }
+#endif
+}
+
+
+template<SANDERS_PERM_PARAMS>
+void 
+SANDERS_PERM_TYPE::permute(int N, permute_vector_t& p_out,
+			   const permute_vector_t& frozen) {
+  sp_vector_sink<perm_t> sink(p_out);
+  run_permute(N, sink, frozen, true);
+}
+
+
+template<SANDERS_PERM_PARAMS>
+template<typename visitor_t>
+void 
+SANDERS_PERM_TYPE::permute_visit(int N, visitor_t& visitor) {
+  sp_visitor_sink<perm_t, visitor_t> sink(visitor);
+  permute_vector_t frozen;
+  run_permute(N, sink, frozen, false);
+}
+
+
+template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
+void 
+SANDERS_PERM_TYPE::permute_into(int N, sink_t& sink) {
+  permute_vector_t frozen;
+  run_permute(N, sink, frozen, false);
+}
+
+
+template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
+void 
+SANDERS_PERM_TYPE::permute_into(int N, sink_t& sink,
+				const permute_vector_t& frozen) {
+  run_permute(N, sink, frozen, true);
+}
+
+
+// Item i of rank r travels through phases 1 and 2 as the id i*N + r, so
+// the owner of an id is id % N without a table of the item counts; the
+// position of an id in the concatenated phase 2 buffers is its rank.
+// Instead of phase 3, every (id, rank) pair goes back to the owner of the
+// id in one Alltoallv.
+template<SANDERS_PERM_PARAMS>
+void 
+SANDERS_PERM_TYPE::assign_random_ranks(int N, unsigned int local_count,
+				       permute_vector_t& ranks_out) {
+  struct pair_t {
+    perm_t id;
+    perm_t rank;
+  };
+
+  if (MPI_Comm_rank(MPI_COMM_WORLD, &rank) != 0)
+    error("MPI_Comm_rank", "Error getting the rank");
+
+  permute_vector_t ids(local_count);
+  for (unsigned int i=0; i < local_count; ++i)
+    ids[i] = (perm_t)i*N + rank;
+
+  gen.seed(seed_value, rank);
+  if (telemetry) {
+    telemetry->start(rank);
+    telemetry->set_phase(SP_PHASE_1);
+  }
+
+  const double psize = sizeof(perm_t);
+  double start = MPI_Wtime();
+
+  perm_t* temp;
+  unsigned int sz = 0;
+  permute_vector_t none;
+  pacer.reset();
+  run_phase1(local_count, 0, none, N, &temp, sz, 
+	     ids.empty() ? NULL : &ids[0]);
+
+  if (roofline) {
+    // write the ids, then as in permute
+    double now = MPI_Wtime();
+    roofline->record(SP_PHASE_1, now - start,
+		     local_count*(5*psize + 2*sizeof(unsigned int)) + sz*psize,
+		     remote*psize);
+    start = now;
+  }
+
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_2);
+
+  run_phase2(&temp, sz);
+
+  if (roofline) {
+    double now = MPI_Wtime();
+    roofline->record(SP_PHASE_2, now - start, 4*sz*psize, 0);
+    start = now;
+  }
+
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_3);
+
+  perm_t size = sz, first = 0;
+  if (waits)
+    waits->enter(SP_PHASE_3, "MPI_Exscan");
+  if (MPI_Exscan(&size, &first, 1, SP_DATA_TYPE, MPI_SUM, 
+		 MPI_COMM_WORLD) != 0)
+    error("MPI_Exscan", "Error getting prefix sums of the ranks");
+  if (waits)
+    waits->exit();
+  if (rank == 0)
+    first = 0;
+
+  std::vector<pair_t> pairs(sz), received;
+  std::vector<int> owners(sz);
+  unsigned int sent = 0;
+  for (unsigned int i=0; i < sz; ++i) {
+    pairs[i].id = temp[i];
+    pairs[i].rank = first + i;
+    owners[i] = temp[i] % N;
+    if (owners[i] != rank)
+      ++sent;
+  }
+  delete[] temp;
+
+  pacer.acquire(sent*sizeof(pair_t));
+
+  MPI_Datatype pair_type;
+  MPI_Type_contiguous(sizeof(pair_t), MPI_BYTE, &pair_type);
+  MPI_Type_commit(&pair_type);
+  sp_exchange_by_dest(pairs, owners, N, pair_type, received, 
+		      waits, SP_PHASE_3);
+  MPI_Type_free(&pair_type);
+
+  if (telemetry) {
+    // the pairs this rank kept are among the received ones
+    telemetry->add_sent(sent*sizeof(pair_t));
+    telemetry->add_received((received.size() - (sz - sent))*sizeof(pair_t));
+  }
+
+  ranks_out.resize(local_count);
+  for (unsigned long k=0; k < received.size(); ++k)
+    ranks_out[received[k].id / N] = received[k].rank;
+
+  if (roofline)
+    // read the ids, build, bucket and receive the pairs, write the ranks
+    roofline->record(SP_PHASE_3, MPI_Wtime() - start,
+		     sz*psize + 3*sz*sizeof(pair_t) + local_count*psize,
+		     sent*sizeof(pair_t));
+
+  if (telemetry) {
+    telemetry->set_phase(SP_PHASE_DONE);
+    telemetry->finish();
+  }
+}
+
+
+// The number of chosen positions in every block follows a multivariate
+// hypergeometric distribution drawn from a shared stream, so every rank
+// knows all counts without communication. Each rank picks its positions
+// by selection sampling, and the chosen values, numbered in rank order,
+// go through phases 1 to 3 as if they were a block-distributed array
+// with these counts.
+template<SANDERS_PERM_PARAMS>
+void 
+SANDERS_PERM_TYPE::reshuffle(int N, double fraction, permute_vector_t& p_out) {
+  if (MPI_Comm_rank(MPI_COMM_WORLD, &rank) != 0)
+    error("MPI_Comm_rank", "Error getting the rank");
+
+  unsigned int m = std::ceil((double)n/(double)N);
+  std::vector<unsigned int> caps(N, 0);
+  for (int rp=0; rp < N; ++rp) {
+    perm_t first = std::min((perm_t)rp*m, n);
+    caps[rp] = std::min(first + m, n) - first;
+  }
+
+  // all ranks return if any block is wrong, or the others would wait in
+  // the collectives of phase 1
+  int bad = (p_out.size() != caps[rank]), anybad = 0;
+  if (bad)
+    error("-", "Block size does not match the permutation size");
+  if (waits)
+    waits->enter(SP_PHASE_IDLE, "MPI_Allreduce");
+  if (MPI_Allreduce(&bad, &anybad, 1, MPI_INT, MPI_MAX, 
+		    MPI_COMM_WORLD) != 0)
+    error("MPI_Allreduce", "Error agreeing on the block sizes");
+  if (waits)
+    waits->exit();
+  if (anybad)
+    return;
+
+  fraction = std::max(0.0, std::min(fraction, 1.0));
+  unsigned long draws = std::floor(fraction * (double)n + 0.5);
+
+  // picks[r] - chosen positions of rank r, bounds[r] - chosen before r
+  rng_t shared(gen);
+  shared.seed(seed_value, SP_RESHUFFLE_STREAMS);
+  std::vector<unsigned int> picks;
+  multivariate_hypergeometric(shared, caps, draws, picks);
+
+  std::vector<perm_t> bounds(N+1, 0);
+  for (int rp=0; rp < N; ++rp)
+    bounds[rp+1] = bounds[rp] + picks[rp];
+
+  gen.seed(seed_value, rank);
+  if (telemetry) {
+    telemetry->start(rank);
+    telemetry->set_phase(SP_PHASE_1);
+  }
+
+  // selection sampling keeps the chosen local indices sorted
+  unsigned int want = picks[rank];
+  std::vector<unsigned int> chosen;
+  permute_vector_t values;
+  chosen.reserve(want);
+  values.reserve(want);
+  boost::random::uniform_01<double> uni;
+  for (unsigned int i=0; (i < p_out.size()) && (chosen.size() < want); ++i) {
+    unsigned int need = want - chosen.size();
+    if (((double)(p_out.size() - i) * uni(gen)) < need) {
+      chosen.push_back(i);
+      values.push_back(p_out[i]);
+    }
+  }
+
+  perm_t* temp;
+  unsigned int sz = 0;
+  permute_vector_t none;
+  pacer.reset();
+  run_phase1(want, bounds[rank], none, N, &temp, sz, 
+	     values.empty() ? NULL : &values[0]);
+
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_2);
+
+  run_phase2(&temp, sz);
+
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_3);
+
+  sp_vector_sink<perm_t> sink(values);
+  run_phase3(temp, sz, bounds, bounds[rank], want, none, true, sink);
+  delete[] temp;
+
+  for (unsigned int k=0; k < want; ++k)
+    p_out[chosen[k]] = values[k];
+
+  if (telemetry) {
+    telemetry->set_phase(SP_PHASE_DONE);
+    telemetry->finish();
+  }
+}
+
+
+template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
+void 
+SANDERS_PERM_TYPE::run_permute(int N, sink_t& sink,
+			       const permute_vector_t& frozen,
+			       bool constrained) {
 
   if (MPI_Comm_rank(MPI_COMM_WORLD, &rank) != 0)
     error("MPI_Comm_rank", "Error getting the rank");
@@ -128,80 +582,146 @@ SANDERS_PERM_TYPE::permute(int N, permute_vector_t& p_out) {
   if (pos >= n)
     count = 0;
 
+  // frozen indices sorted, without duplicates and restricted to the block
+  permute_vector_t fixed;
+  unsigned int outside = 0;
+  for (unsigned int k=0; k < frozen.size(); ++k) {
+    if ((frozen[k] >= pos) && (frozen[k] < (pos+count)))
+      fixed.push_back(frozen[k]);
+    else
+      ++outside;
+  }
+
+  if (outside > 0)
+    error("-", std::to_string(outside) + 
+	  " frozen indices outside of the local block ignored");
+
+  std::sort(fixed.begin(), fixed.end());
+  fixed.erase(std::unique(fixed.begin(), fixed.end()), fixed.end());
+
+  // bounds[r] - number of free positions before rank r
+  std::vector<perm_t> bounds(N+1, 0);
+  if (constrained) {
+    unsigned int nfree = count - fixed.size();
+    std::vector<unsigned int> frees(N, 0);
+    if (waits)
+      waits->enter(SP_PHASE_IDLE, "MPI_Allgather");
+    if (MPI_Allgather(&nfree, 1, MPI_UNSIGNED,
+		      &frees[0], 1, MPI_UNSIGNED, MPI_COMM_WORLD) != 0)
+      error("MPI_Allgather", "Error exchanging free position counts");
+    if (waits)
+      waits->exit();
+
+    for (int rp=0; rp < N; ++rp)
+      bounds[rp+1] = bounds[rp] + frees[rp];
+  } else {
+    for (int rp=0; rp < N; ++rp)
+      bounds[rp+1] = std::min((perm_t)(rp+1)*m, n);
+  }
+
+  gen.seed(seed_value, rank);
+
   perm_t* temp;
   unsigned int sz = 0;
 
 #ifdef PRINT_DEBUG
   std::cout << "r:" << rank << "m:" << m 
 	    << ", pos:" << pos << ", count:" << count
+	    << ", frozen:" << fixed.size()
 	    << std::endl;
 #endif
-  //  int* perm; // final output
 
-  run_phase1(count, pos, N, &temp, sz);
+  if (telemetry) {
+    telemetry->start(rank);
+    telemetry->set_phase(SP_PHASE_1);
+  }
+
+  const double psize = sizeof(perm_t);
+  unsigned int nfree = count - fixed.size();
+  double start = MPI_Wtime();
+
+  pacer.reset();
+  if ((exchange == SP_BUTTERFLY) && sp_is_power_of_two(N) && 
+      !pacer.enabled())
+    run_phase1_butterfly(count, pos, fixed, N, bounds, &temp, sz);
+  else
+    run_phase1(count, pos, fixed, N, &temp, sz);
+
+  if (roofline) {
+    // generate the element and its destination, bucket, send, receive
+    double now = MPI_Wtime();
+    roofline->record(SP_PHASE_1, now - start,
+		     nfree*(4*psize + 2*sizeof(unsigned int)) + sz*psize,
+		     remote*psize);
+    start = now;
+  }
+
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_2);
+
   run_phase2(&temp, sz);
 
-  unsigned int allocsz = m;
-  if ((rank == (N-1)) && 
-      count > 0)
-    allocsz = count;
+  if (roofline) {
+    double now = MPI_Wtime();
+    roofline->record(SP_PHASE_2, now - start, 4*sz*psize, 0);
+    start = now;
+  }
 
-  p_out.resize(allocsz);
+  if (telemetry)
+    telemetry->set_phase(SP_PHASE_3);
 
-  run_phase3(temp, sz, m, pos, count, p_out);
+  run_phase3(temp, sz, bounds, pos, count, fixed, constrained, sink);
 
-  delete[] temp;
+  if (roofline)
+    roofline->record(SP_PHASE_3, MPI_Wtime() - start, 
+		     (sz + count)*psize, remote*psize);
 
-#ifdef PRINT_DEBUG
-  if (rank == debug_rank) {
-    std::cout << "@Rank " << rank << std::endl;
-    for(unsigned int q=0; q < allocsz; ++q) {
-      std::cout << p_out[q] << ",";
-    }
+  delete[] temp;
 
-    std::cout << std::endl;
+  if (telemetry) {
+    telemetry->set_phase(SP_PHASE_DONE);
+    telemetry->finish();
   }
-#endif
-
 }
 
 
-struct sort_indices
-{
-private:
-  unsigned int* parr;
-public:
-  sort_indices(unsigned int* p_parr) : parr(p_parr) {}
-  bool operator()(int i, int j) const { return parr[i]<parr[j]; }
-};
-
 template<SANDERS_PERM_PARAMS>
 void 
-SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N, 
-			      perm_t** temp, unsigned int& total) {
+SANDERS_PERM_TYPE::run_phase1(unsigned int blockcount, perm_t pos, 
+			      const permute_vector_t& frozen, unsigned int N, 
+			      perm_t** temp, unsigned int& total,
+			      const perm_t* values) {
+
+  // frozen indices stay where they are and are not sent
+  unsigned int count = blockcount - frozen.size();
 
   perm_t* sendbuf = new perm_t[count+1];
   perm_t* sortedsendbuf = new perm_t[count+1];
   unsigned int* destprocs = new unsigned int[count+1];
-  unsigned int* indices = new unsigned int[count+1];
 
   // for random number generation
-  boost::random::mt19937 gen;
   boost::random::uniform_int_distribution<> dist(0, (N-1));
 
-  for (unsigned int k=0; k <= (count-1); ++k) {
-    sendbuf[k] = pos+(perm_t)k;
+  unsigned int f = 0;
+  unsigned int k = 0;
+  for (unsigned int i=0; i < blockcount; ++i) {
+    if ((f < frozen.size()) && (frozen[f] == (pos+(perm_t)i))) {
+      ++f;
+      continue;
+    }
+
+    // values replace the indices when given
+    sendbuf[k] = values ? values[i] : pos+(perm_t)i;
     destprocs[k] = dist(gen);
-    indices[k] = k;
+    ++k;
   }
 
-  sendbuf[count] = 0;
-  destprocs[count] = N;
-  indices[count] = count;
+  if (telemetry)
+    telemetry->add_generated(count);
 
 #ifdef PRINT_DEBUG
   std::cout << "printing unsorted ..." << std::endl;
-  for (unsigned int i=0; i < (count+1); ++i) {
+  for (unsigned int i=0; i < count; ++i) {
     std::cout << "(" << destprocs[i] << ","
 	      << sendbuf[i] << "), ";
   }
@@ -209,20 +729,17 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
   std::cout << std::endl;
 #endif
 
-  // sort arrays by rank
-  std::sort(indices, (indices+count+1), sort_indices(destprocs)); 
-
-  // copy sendbuf to sortedsendbuf
-  for(unsigned int i=0; i < (count+1); ++i) {
-    sortedsendbuf[i] = sendbuf[indices[i]];
-  }
+  // group by rank
+  std::vector<int> sendcnts, sdispls;
+  sp_bucket_by_dest(sendbuf, destprocs, count, N, sortedsendbuf, 
+		    sendcnts, sdispls);
+  remote = count - sendcnts[rank];
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
     std::cout << "printing sorted ..." << std::endl;
-    for (unsigned int i=0; i < (count+1); ++i) {
-      std::cout << "(" << destprocs[indices[i]] << ","
-		<< sortedsendbuf[i] << "), ";
+    for (unsigned int i=0; i < count; ++i) {
+      std::cout << sortedsendbuf[i] << ", ";
     }
   
     std::cout << std::endl;
@@ -232,17 +749,6 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
   // we do not need sendbuf now
   delete[] sendbuf;
 
-  std::vector<int> sendcnts;
-  sendcnts.resize(N, 0);
-
-  int k = 0;
-  for (unsigned int rp=0; rp <= (N-1); ++rp) {
-    while(rp == destprocs[indices[k]]) {
-      ++sendcnts[rp];
-      ++k;
-    }
-  }
-
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
     std::cout << "printing sendcnts..." << std::endl;
@@ -256,14 +762,6 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
 
 
   delete[] destprocs;
-  delete[] indices;
-
-  //calculate displacements
-  std::vector<int> sdispls;
-  sdispls.resize(N, 0);
-  for (unsigned int hp = 1; hp <= (N-1); ++hp) {
-    sdispls[hp] = sdispls[hp-1]+sendcnts[hp-1];
-  } 
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
@@ -278,10 +776,14 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
 
   std::vector<int> recvcnts;
   recvcnts.resize(N,0);
+  if (waits)
+    waits->enter(SP_PHASE_1, "MPI_Alltoall");
   if (MPI_Alltoall(&sendcnts[0], 1, MPI_UNSIGNED, 
 		   &recvcnts[0], 1, MPI_UNSIGNED, MPI_COMM_WORLD) != 0) {
     error("MPI_Alltoall", "Error exchanging send counts and receive counts in phase 1");
   }
+  if (waits)
+    waits->exit();
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
@@ -324,10 +826,68 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
   //std::vector<perm_t> temp;
   //temp.resize(total);
   
-  if (MPI_Alltoallv(&sortedsendbuf[0], &sendcnts[0], &sdispls[0], SP_DATA_TYPE,
-			     (*temp), &recvcnts[0], &rdispls[0], SP_DATA_TYPE,
-		    MPI_COMM_WORLD) != 0)
-    error("MPI_Alltoallv", "Error exchanging permuted values in phase 1");
+  // Paced: the same exchange in rounds, round k carrying slice k of the
+  // elements for every destination. Slices follow from the counts alone,
+  // so the receive buffer ends up as with a single Alltoallv.
+  unsigned long rounds = 1;
+  if (pacer.enabled()) {
+    // the most rounds any rank needs with its own chunk
+    unsigned long bytes = (unsigned long)count * sizeof(perm_t);
+    unsigned long mine = 
+      std::max(1UL, (bytes + pacing_chunk - 1) / pacing_chunk);
+    if (waits)
+      waits->enter(SP_PHASE_1, "MPI_Allreduce");
+    if (MPI_Allreduce(&mine, &rounds, 1, MPI_UNSIGNED_LONG, MPI_MAX,
+		      MPI_COMM_WORLD) != 0)
+      error("MPI_Allreduce", "Error agreeing on paced rounds in phase 1");
+    if (waits)
+      waits->exit();
+  }
+
+  if ((exchange == SP_PAIRWISE) && !pacer.enabled())
+    rounds = 0;
+
+  std::vector<int> scnts(N), sdisp(N), rcnts(N), rdisp(N);
+  for (unsigned long k=0; k < rounds; ++k) {
+    unsigned long bytes = 0;
+    for (unsigned int rp=0; rp < N; ++rp) {
+      unsigned long slo = (unsigned long)sendcnts[rp] * k / rounds;
+      unsigned long shi = (unsigned long)sendcnts[rp] * (k+1) / rounds;
+      unsigned long rlo = (unsigned long)recvcnts[rp] * k / rounds;
+      unsigned long rhi = (unsigned long)recvcnts[rp] * (k+1) / rounds;
+      scnts[rp] = shi - slo;
+      sdisp[rp] = sdispls[rp] + slo;
+      rcnts[rp] = rhi - rlo;
+      rdisp[rp] = rdispls[rp] + rlo;
+      bytes += scnts[rp] * sizeof(perm_t);
+    }
+
+    pacer.acquire(bytes);
+
+    if (waits)
+      waits->enter(SP_PHASE_1, "MPI_Alltoallv");
+    if (MPI_Alltoallv(&sortedsendbuf[0], &scnts[0], &sdisp[0], SP_DATA_TYPE,
+		      (*temp), &rcnts[0], &rdisp[0], SP_DATA_TYPE,
+		      MPI_COMM_WORLD) != 0)
+      error("MPI_Alltoallv", "Error exchanging permuted values in phase 1");
+    if (waits)
+      waits->exit();
+
+    // every rank runs the same rounds, so paced runs report per round
+    if (telemetry) {
+      unsigned long received = 0;
+      for (unsigned int rp=0; rp < N; ++rp)
+	received += rcnts[rp];
+      telemetry->add_sent(bytes);
+      telemetry->add_received(received*sizeof(perm_t));
+      if (rounds > 1)
+	telemetry->checkpoint();
+    }
+  }
+
+  if (rounds == 0)
+    run_pairwise_exchange(sortedsendbuf, sendcnts, sdispls, 
+			  *temp, recvcnts, rdispls, N);
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
@@ -340,28 +900,151 @@ SANDERS_PERM_TYPE::run_phase1(unsigned int count, perm_t pos, unsigned int N,
 
   delete[] sortedsendbuf;
 
+  if (waits)
+    waits->enter(SP_PHASE_1, "MPI_Barrier");
   if (MPI_Barrier(MPI_COMM_WORLD) != 0)
     error("MPI_Barrier", "Error synchronizing processes in phase 1");
+  if (waits)
+    waits->exit();
+}
+
+
+// Phase 1 through the butterfly exchange; every rank ends up with exactly
+// the elements of its own block, so phase 3 only copies locally.
+template<SANDERS_PERM_PARAMS>
+void 
+SANDERS_PERM_TYPE::run_phase1_butterfly(unsigned int blockcount, perm_t pos, 
+					const permute_vector_t& frozen, 
+					unsigned int N, 
+					const std::vector<perm_t>& bounds,
+					perm_t** temp, unsigned int& total) {
+  permute_vector_t elems;
+  elems.reserve(blockcount);
+
+  unsigned int f = 0;
+  for (unsigned int i=0; i < blockcount; ++i) {
+    if ((f < frozen.size()) && (frozen[f] == (pos+(perm_t)i)))
+      ++f;
+    else
+      elems.push_back(pos+(perm_t)i);
+  }
+
+  if (telemetry)
+    telemetry->add_generated(elems.size());
+
+  unsigned long sent, received;
+  butterfly_exchange(elems, bounds, gen, gen, seed_value, rank, N,
+		     sent, received);
+  remote = sent;
+
+  if (telemetry) {
+    telemetry->add_sent(sent*sizeof(perm_t));
+    telemetry->add_received(received*sizeof(perm_t));
+  }
+
+  total = elems.size();
+  (*temp) = new perm_t[total];
+  std::copy(elems.begin(), elems.end(), (*temp));
+
+  if (waits)
+    waits->enter(SP_PHASE_1, "MPI_Barrier");
+  if (MPI_Barrier(MPI_COMM_WORLD) != 0)
+    error("MPI_Barrier", "Error synchronizing processes in phase 1");
+  if (waits)
+    waits->exit();
+}
+
+
+// The Alltoallv of phase 1 as N-1 rounds of pairwise exchanges; the
+// receive buffer ends up the same.
+template<SANDERS_PERM_PARAMS>
+void 
+SANDERS_PERM_TYPE::run_pairwise_exchange(const perm_t* sendbuf, 
+					 const std::vector<int>& sendcnts,
+					 const std::vector<int>& sdispls,
+					 perm_t* recvbuf,
+					 const std::vector<int>& recvcnts,
+					 const std::vector<int>& rdispls,
+					 unsigned int N) {
+  std::copy(sendbuf + sdispls[rank], sendbuf + sdispls[rank] + sendcnts[rank],
+	    recvbuf + rdispls[rank]);
+
+  bool xor_pairs = sp_is_power_of_two(N);
+
+  // publishes the counters of round k once it completed
+  unsigned int completed = 0;
+  auto account = [&](unsigned int k) {
+    if (!telemetry)
+      return;
+    unsigned int to = xor_pairs ? (rank ^ k) : ((rank + k) % N);
+    unsigned int from = xor_pairs ? (rank ^ k) : ((rank + N - k) % N);
+    telemetry->add_sent(sendcnts[to]*sizeof(perm_t));
+    telemetry->add_received(recvcnts[from]*sizeof(perm_t));
+    telemetry->poll();
+  };
+
+  account(completed++);
+
+  // two requests per round, the oldest round completes first
+  std::vector<MPI_Request> requests;
+  for (unsigned int k=1; k < N; ++k) {
+    if (requests.size() == 2*SP_PAIRWISE_WINDOW) {
+      if (MPI_Waitall(2, &requests[0], MPI_STATUSES_IGNORE) != 0)
+	error("MPI_Waitall", "Error completing pairwise exchanges in phase 1");
+      requests.erase(requests.begin(), requests.begin()+2);
+      account(completed++);
+    }
+
+    unsigned int to = xor_pairs ? (rank ^ k) : ((rank + k) % N);
+    unsigned int from = xor_pairs ? (rank ^ k) : ((rank + N - k) % N);
+
+    MPI_Request request;
+    if (MPI_Irecv(recvbuf + rdispls[from], recvcnts[from], SP_DATA_TYPE, 
+		  from, 4, MPI_COMM_WORLD, &request) != 0)
+      error("MPI_Irecv", "Error receiving pairwise exchange in phase 1");
+    requests.push_back(request);
+
+    if (MPI_Isend(sendbuf + sdispls[to], sendcnts[to], SP_DATA_TYPE, 
+		  to, 4, MPI_COMM_WORLD, &request) != 0)
+      error("MPI_Isend", "Error sending pairwise exchange in phase 1");
+    requests.push_back(request);
+  }
+
+  if (!requests.empty() &&
+      (MPI_Waitall(requests.size(), &requests[0], MPI_STATUSES_IGNORE) != 0))
+    error("MPI_Waitall", "Error completing pairwise exchanges in phase 1");
+
+  while (completed < N)
+    account(completed++);
 }
 
 
 template<SANDERS_PERM_PARAMS>
 void 
 SANDERS_PERM_TYPE::run_phase2(perm_t** temp, unsigned int total) {
-  boost::random::mt19937 gen;
-
-  if (total > 1) {
-    for (int k=(total-1); k >=1; --k) {
-      boost::random::uniform_int_distribution<> dist(0, k);
-      int l = dist(gen);
-      int t = (*temp)[k];
-      (*temp)[k] = (*temp)[l];
-      (*temp)[l] = t;
+  sp_phase2_engine e = engine;
+  if (e == SP_PHASE2_AUTO) {
+    if (!calibration_loaded) {
+      const char* path = getenv("SP_PHASE2_CALIBRATION");
+      calibration.load(path ? path : SP_PHASE2_CALIBRATION_FILE);
+      calibration_loaded = true;
     }
+    e = calibration.choose(total, nthreads, sizeof(perm_t));
   }
 
+  if (e == SP_DART_THROWING)
+    dart_shuffle(*temp, total, nthreads, gen, seed_value, rank);
+  else if (e == SP_BUCKET_SHUFFLE)
+    bucket_shuffle(*temp, total, gen);
+  else
+    fisher_yates_shuffle(*temp, total, gen);
+
+  if (waits)
+    waits->enter(SP_PHASE_2, "MPI_Barrier");
   if (MPI_Barrier(MPI_COMM_WORLD) != 0)
     error("MPI_Barrier", "Error synchronizing processes in phase 2");
+  if (waits)
+    waits->exit();
 
 #ifdef PRINT_DEBUG
   std::cout << "printing after local permuation " << std::endl;
@@ -376,91 +1059,222 @@ SANDERS_PERM_TYPE::run_phase2(perm_t** temp, unsigned int total) {
 }
 
 
+// Hands values for local offsets [off, off+count) to the sink.
 template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
+void 
+SANDERS_PERM_TYPE::emit(sink_t& sink, unsigned int off, 
+			const perm_t* values, unsigned int count) {
+  perm_t* dest = sink.direct();
+  if (dest) {
+    std::copy(values, values+count, dest+off);
+    sink.commit(off, count);
+  } else {
+    sink.put(off, values, count);
+  }
+}
+
+
+// Hands values for free positions [freeoff, freeoff+count) of this rank
+// to the sink, split into runs of consecutive local offsets.
+template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
+void 
+SANDERS_PERM_TYPE::place(sink_t& sink, const std::vector<unsigned int>& slots,
+			 unsigned int freeoff, const perm_t* values, 
+			 unsigned int count) {
+  if (slots.empty()) {
+    emit(sink, freeoff, values, count);
+    return;
+  }
+
+  unsigned int k = 0;
+  while (k < count) {
+    unsigned int start = slots[freeoff+k];
+    unsigned int len = 1;
+    while (((k+len) < count) && (slots[freeoff+k+len] == (start+len)))
+      ++len;
+
+    emit(sink, start, &values[k], len);
+    k += len;
+  }
+}
+
+
+template<SANDERS_PERM_PARAMS>
+template<typename sink_t>
 void 
 SANDERS_PERM_TYPE::run_phase3(perm_t* temp, unsigned int sz,
-			      unsigned int m,
+			      const std::vector<perm_t>& bounds,
 			      perm_t pos,
 			      unsigned int count,
-			      permute_vector_t& perm) {
+			      const permute_vector_t& frozen,
+			      bool constrained,
+			      sink_t& sink) {
+
+  sink.begin(pos, count);
+  remote = 0;
 
   perm_t size = (perm_t)sz;
   perm_t first;
   
+  if (waits)
+    waits->enter(SP_PHASE_3, "MPI_Scan");
   if (MPI_Scan(&size, &first, 1, 
 	       SP_DATA_TYPE, MPI_SUM, MPI_COMM_WORLD) != 0)
     error("MPI_Scan", "Error getting prefix sums in phase 3");
+  if (waits)
+    waits->exit();
   
 #ifdef PRINT_DEBUG
   std::cout << "rank : " << rank << " first : " << first << std::endl;
 #endif
 
+  // positions are counted over free positions only; [first, last) are
+  // the positions of the local elements
   first = first - size;
-  perm_t last = first + size - 1;
-  double fmdiv = (double)first / (double)m;
-  unsigned int rp = std::floor(fmdiv);
-  perm_t firstp = first;
-  unsigned int remains = count;
+  perm_t last = first + size;
+  perm_t mine = bounds[rank];
+  unsigned int remains = bounds[rank+1] - mine;
+
+  // local index of every free position, only needed with frozen indices;
+  // frozen positions are final right away
+  std::vector<unsigned int> slots;
+  if (!frozen.empty()) {
+    slots.reserve(remains);
+    unsigned int f = 0;
+    for (unsigned int k=0; k < count; ++k) {
+      if ((f < frozen.size()) && (frozen[f] == (pos+(perm_t)k)))
+	++f;
+      else
+	slots.push_back(k);
+    }
+
+    f = 0;
+    while (f < frozen.size()) {
+      unsigned int len = 1;
+      while (((f+len) < frozen.size()) && (frozen[f+len] == (frozen[f]+len)))
+	++len;
+
+      emit(sink, frozen[f]-pos, &frozen[f], len);
+      f += len;
+    }
+  }
+
+  // one (first, count) header per outgoing piece; reserved up front so that
+  // the buffers of pending sends do not move. Paced runs cut the ranges
+  // into pieces of at most piece elements.
+  perm_t piece = pacer.enabled() ? 
+    std::max((perm_t)1, (perm_t)(pacing_chunk / sizeof(perm_t))) : size;
+  std::vector<perm_t> headers;
+  if (size > 0) {
+    unsigned int rfirst = std::upper_bound(bounds.begin(), bounds.end(), 
+					   first) - bounds.begin();
+    unsigned int rlast = std::upper_bound(bounds.begin(), bounds.end(), 
+					  last-1) - bounds.begin();
+    headers.reserve(2*(rlast-rfirst+1 + size/piece));
+  }
 
   std::vector<MPI_Request> requests;
   MPI_Request request;
-  perm_t* buf = new perm_t[2];
+
+  // ranks whose blocks the sink shares with this rank get their ranges
+  // copied in; with frozen indices free and local offsets differ
+  bool shared = !constrained && (sink.peer(rank) != NULL);
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank) {
-    std::cout << "firstp:" << firstp << ", last:" << last
-	      << ", remains:" << remains << ", rp:" << rp
+    std::cout << "first:" << first << ", last:" << last
+	      << ", remains:" << remains
 	      << ", pos:" << pos
-	      << ", first:" << first 
 	      << std::endl;
   }
 #endif
 
-  do {
-    perm_t lastp = (rp+1)*m - 1;
-    if (lastp > last)
-      lastp = last;
+  perm_t firstp = first;
+  while (firstp < last) {
+    unsigned int rp = std::upper_bound(bounds.begin(), bounds.end(), 
+				       firstp) - bounds.begin() - 1;
+    perm_t lastp = std::min(bounds[rp+1], last);
+    unsigned int countp = lastp-firstp;
 
-    unsigned int countp = lastp-firstp+1;
+    perm_t* peer = shared ? sink.peer(rp) : NULL;
     if (rank == (int)rp) {
-      for (unsigned int k=firstp; k<=lastp; ++k) {
-	perm[k-pos]=temp[k-first];
-      }
-
+      place(sink, slots, firstp-mine, &temp[firstp-first], countp);
       remains -= countp;
+    } else if (peer) {
+      std::copy(&temp[firstp-first], &temp[firstp-first] + countp,
+		peer + (firstp-bounds[rp]));
+      sink.deposited(rp, countp);
     } else {
-      buf[0] = firstp;
-      buf[1] = (perm_t)countp;
+      for (perm_t f=firstp; f < lastp; f += piece) {
+	unsigned int c = std::min(piece, lastp - f);
+	pacer.acquire(c*sizeof(perm_t));
+
+	headers.push_back(f);
+	headers.push_back((perm_t)c);
 
-      if (MPI_Isend(&buf[0], 2, SP_DATA_TYPE, rp, 1, 
-		    MPI_COMM_WORLD, &request) != 0)
-	error("MPI_Isend", "Error exchanging first and last values in phase 3");
+	if (MPI_Isend(&headers[headers.size()-2], 2, SP_DATA_TYPE, rp, 1, 
+		      MPI_COMM_WORLD, &request) != 0)
+	  error("MPI_Isend", "Error exchanging first and last values in phase 3");
 
-      requests.push_back(request);
+	requests.push_back(request);
 
-      if (MPI_Isend(&temp[firstp-first], countp, SP_DATA_TYPE, rp, 2, 
-		    MPI_COMM_WORLD, &request) != 0)
-	error("MPI_Isend", "Error sending surplus elements to others in phas 3");
+	if (MPI_Isend(&temp[f-first], c, SP_DATA_TYPE, rp, 2, 
+		      MPI_COMM_WORLD, &request) != 0)
+	  error("MPI_Isend", "Error sending surplus elements to others in phas 3");
 
-      requests.push_back(request);
+	requests.push_back(request);
+      }
+
+      remote += countp;
+      if (telemetry)
+	telemetry->add_sent(countp*sizeof(perm_t));
     }
     
-    rp += 1;
-    firstp += countp;
+    firstp = lastp;
 #ifdef PRINT_DEBUG
     if (rank == debug_rank) {
       std::cout << "rp: " << rp << "firstp:" << firstp << std::endl;
     }
 #endif
-  }while(firstp < last);
+  }
 
 #ifdef PRINT_DEBUG
   if (rank == debug_rank)
     std::cout << "remains 1: " << remains << std::endl;
 #endif
 
+  perm_t buf[2];
+  permute_vector_t recvbuf;
+  unsigned long arrived = 0;
+  unsigned int idle = 0;
   while(remains > 0) {
     MPI_Status status;
+
+    // ranges copied in by same-node ranks, or poll for a message
+    if (shared) {
+      unsigned long a = sink.arrivals();
+      if (a > arrived) {
+	remains -= (a - arrived);
+	arrived = a;
+	idle = 0;
+	continue;
+      }
+
+      int flag = 0;
+      if (MPI_Iprobe(MPI_ANY_SOURCE, 1, MPI_COMM_WORLD, &flag, 
+		     MPI_STATUS_IGNORE) != 0)
+	error("MPI_Iprobe", "Error polling for headers in phase 3");
+      if (!flag) {
+	// same-node senders may share this core when ranks oversubscribe
+	if (++idle > SP_PHASE3_SPINS)
+	  std::this_thread::yield();
+	continue;
+      }
+      idle = 0;
+    }
+
     if (MPI_Recv(&buf[0], 2, SP_DATA_TYPE, MPI_ANY_SOURCE, 1, 
 		 MPI_COMM_WORLD, &status)!=0)
       error("MPI_Recv", "Error while receiving first and last values in phase 3");
@@ -468,11 +1282,32 @@ SANDERS_PERM_TYPE::run_phase3(perm_t* temp, unsigned int sz,
     firstp = buf[0];
     unsigned int countp = buf[1];
 
-    if (MPI_Recv(&perm[firstp-pos], countp, SP_DATA_TYPE, 
+    // receive in place when the sink has storage and the positions are
+    // contiguous
+    perm_t* dest = sink.direct();
+    bool inplace = (dest != NULL) && slots.empty();
+    if (inplace) {
+      dest += (firstp-mine);
+    } else {
+      recvbuf.resize(countp);
+      dest = &recvbuf[0];
+    }
+
+    if (MPI_Recv(dest, countp, SP_DATA_TYPE, 
 		 status.MPI_SOURCE, 2, MPI_COMM_WORLD, &status) != 0)
             error("MPI_Recv", "Error while receiving additional values in phase 3");
 
+    if (inplace)
+      sink.commit(firstp-mine, countp);
+    else
+      place(sink, slots, firstp-mine, dest, countp);
+
     remains -= countp;
+
+    if (telemetry) {
+      telemetry->add_received(countp*sizeof(perm_t));
+      telemetry->poll();
+    }
 #ifdef PRINT_DEBUG
     if (rank == debug_rank)
       std::cout << "remains : " << remains << std::endl;
@@ -486,9 +1321,15 @@ SANDERS_PERM_TYPE::run_phase3(perm_t* temp, unsigned int sz,
   }
 
   requests.clear();
-  delete[] buf;
+  sink.end();
 
+  if (waits)
+    waits->enter(SP_PHASE_3, "MPI_Barrier");
   if (MPI_Barrier(MPI_COMM_WORLD) !=0)
     error("MPI_Barrier", "Error invoking barrier in phase 3");
+  if (waits)
+    waits->exit();
 
 }
+
+#endif
@@ -0,0 +1,277 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Random number policies for the permutation.
+
+   A policy is a uniform random number generator (result_type, min(), max(),
+   operator()) with seed(seed, stream). Every rank and every thread draws
+   from its own stream, so the same seed reproduces the same permutation.
+
+   sp_mt19937_rng - the fast default, predictable.
+   sp_aes_ctr_rng - AES-128 in counter mode keyed by a secret key, for
+   permutations that must not be predictable. The counter block holds the
+   stream in its upper and the block counter in its lower 64 bits. Words
+   are produced in bulk, eight blocks at a time with AES-NI when the CPU
+   supports it and with a byte-oriented software AES otherwise.
+*/
+
+#ifndef SANDERS_RNG_HPP
+#define SANDERS_RNG_HPP
+
+#include <cstring>
+#include <stdint.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/seed_seq.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define SP_HAVE_AESNI
+#endif
+
+#define SP_DEFAULT_SEED 5489UL
+
+// Streams for draws that several ranks must reproduce have the top bit
+// set, which keeps them apart from the per-rank and per-thread streams;
+// bits 61-62 tell the users apart. Users of a single stream share the
+// last value and are told apart by the low bits.
+#define SP_SHARED_STREAM (1UL << 63)
+#define SP_BUTTERFLY_STREAMS (SP_SHARED_STREAM | (0UL << 61))
+#define SP_MINHASH_STREAMS (SP_SHARED_STREAM | (1UL << 61))
+#define SP_SMALL_PERM_STREAMS (SP_SHARED_STREAM | (2UL << 61))
+#define SP_RESHUFFLE_STREAMS (SP_SHARED_STREAM | (3UL << 61) | 0UL)
+#define SP_SPLIT_STREAMS (SP_SHARED_STREAM | (3UL << 61) | 1UL)
+
+class sp_mt19937_rng {
+public:
+  typedef boost::random::mt19937::result_type result_type;
+
+  void seed(unsigned long s, unsigned long stream) {
+    boost::random::seed_seq seq { (uint32_t)s, (uint32_t)(s >> 32),
+	(uint32_t)stream, (uint32_t)(stream >> 32) };
+    gen.seed(seq);
+  }
+
+  static result_type min() { return boost::random::mt19937::min(); }
+  static result_type max() { return boost::random::mt19937::max(); }
+  result_type operator()() { return gen(); }
+
+private:
+  boost::random::mt19937 gen;
+};
+
+
+// number of AES blocks generated per refill
+#define SP_AES_BUFFER_BLOCKS 64
+
+class sp_aes_ctr_rng {
+public:
+  typedef uint32_t result_type;
+
+  // Without a key, the key is derived from the seed passed to seed();
+  // such permutations are reproducible but not secret.
+  sp_aes_ctr_rng() : keyed(false), stream(0), counter(0), 
+		     next(SP_AES_BUFFER_BLOCKS*4) {
+    std::memset(roundkeys, 0, sizeof(roundkeys));
+#ifdef SP_HAVE_AESNI
+    aesni = __builtin_cpu_supports("aes");
+#else
+    aesni = false;
+#endif
+  }
+
+  explicit sp_aes_ctr_rng(const unsigned char key[16]) : sp_aes_ctr_rng() {
+    expand_key(key);
+    keyed = true;
+  }
+
+  void seed(unsigned long s, unsigned long st) {
+    if (!keyed) {
+      unsigned char key[16];
+      for (unsigned int i=0; i < 8; ++i) {
+	key[i] = (unsigned char)(s >> (8*i));
+	key[8+i] = (unsigned char)(~s >> (8*i));
+      }
+      expand_key(key);
+    }
+
+    stream = st;
+    counter = 0;
+    next = SP_AES_BUFFER_BLOCKS*4;
+  }
+
+  static result_type min() { return 0; }
+  static result_type max() { return 0xffffffffU; }
+
+  result_type operator()() {
+    if (next == SP_AES_BUFFER_BLOCKS*4)
+      refill();
+    return words[next++];
+  }
+
+  // encrypts one block with the current key, for testing
+  void encrypt(const unsigned char in[16], unsigned char out[16]) const {
+    std::memcpy(out, in, 16);
+    encrypt_soft(out);
+  }
+
+private:
+  unsigned char roundkeys[11*16];
+  bool keyed;
+  bool aesni;
+  unsigned long stream;
+  unsigned long counter;
+  unsigned int next;
+  uint32_t words[SP_AES_BUFFER_BLOCKS*4];
+
+  static const unsigned char* sbox() {
+    static const unsigned char s[256] = {
+      0x63,0x7c,0x77,0x7b,0xf2,0x6b,0x6f,0xc5,0x30,0x01,0x67,0x2b,0xfe,0xd7,0xab,0x76,
+      0xca,0x82,0xc9,0x7d,0xfa,0x59,0x47,0xf0,0xad,0xd4,0xa2,0xaf,0x9c,0xa4,0x72,0xc0,
+      0xb7,0xfd,0x93,0x26,0x36,0x3f,0xf7,0xcc,0x34,0xa5,0xe5,0xf1,0x71,0xd8,0x31,0x15,
+      0x04,0xc7,0x23,0xc3,0x18,0x96,0x05,0x9a,0x07,0x12,0x80,0xe2,0xeb,0x27,0xb2,0x75,
+      0x09,0x83,0x2c,0x1a,0x1b,0x6e,0x5a,0xa0,0x52,0x3b,0xd6,0xb3,0x29,0xe3,0x2f,0x84,
+      0x53,0xd1,0x00,0xed,0x20,0xfc,0xb1,0x5b,0x6a,0xcb,0xbe,0x39,0x4a,0x4c,0x58,0xcf,
+      0xd0,0xef,0xaa,0xfb,0x43,0x4d,0x33,0x85,0x45,0xf9,0x02,0x7f,0x50,0x3c,0x9f,0xa8,
+      0x51,0xa3,0x40,0x8f,0x92,0x9d,0x38,0xf5,0xbc,0xb6,0xda,0x21,0x10,0xff,0xf3,0xd2,
+      0xcd,0x0c,0x13,0xec,0x5f,0x97,0x44,0x17,0xc4,0xa7,0x7e,0x3d,0x64,0x5d,0x19,0x73,
+      0x60,0x81,0x4f,0xdc,0x22,0x2a,0x90,0x88,0x46,0xee,0xb8,0x14,0xde,0x5e,0x0b,0xdb,
+      0xe0,0x32,0x3a,0x0a,0x49,0x06,0x24,0x5c,0xc2,0xd3,0xac,0x62,0x91,0x95,0xe4,0x79,
+      0xe7,0xc8,0x37,0x6d,0x8d,0xd5,0x4e,0xa9,0x6c,0x56,0xf4,0xea,0x65,0x7a,0xae,0x08,
+      0xba,0x78,0x25,0x2e,0x1c,0xa6,0xb4,0xc6,0xe8,0xdd,0x74,0x1f,0x4b,0xbd,0x8b,0x8a,
+      0x70,0x3e,0xb5,0x66,0x48,0x03,0xf6,0x0e,0x61,0x35,0x57,0xb9,0x86,0xc1,0x1d,0x9e,
+      0xe1,0xf8,0x98,0x11,0x69,0xd9,0x8e,0x94,0x9b,0x1e,0x87,0xe9,0xce,0x55,0x28,0xdf,
+      0x8c,0xa1,0x89,0x0d,0xbf,0xe6,0x42,0x68,0x41,0x99,0x2d,0x0f,0xb0,0x54,0xbb,0x16
+    };
+    return s;
+  }
+
+  static unsigned char xtime(unsigned char x) {
+    return (unsigned char)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+  }
+
+  // AES-128 key schedule; AES-NI uses the same round keys
+  void expand_key(const unsigned char key[16]) {
+    const unsigned char* s = sbox();
+    unsigned char rcon = 0x01;
+    std::memcpy(roundkeys, key, 16);
+    for (unsigned int i=16; i < 176; i += 4) {
+      unsigned char t[4];
+      std::memcpy(t, &roundkeys[i-4], 4);
+      if ((i % 16) == 0) {
+	unsigned char u = t[0];
+	t[0] = s[t[1]] ^ rcon;
+	t[1] = s[t[2]];
+	t[2] = s[t[3]];
+	t[3] = s[u];
+	rcon = xtime(rcon);
+      }
+
+      for (unsigned int j=0; j < 4; ++j)
+	roundkeys[i+j] = roundkeys[i-16+j] ^ t[j];
+    }
+  }
+
+  void encrypt_soft(unsigned char* st) const {
+    const unsigned char* s = sbox();
+    for (unsigned int j=0; j < 16; ++j)
+      st[j] ^= roundkeys[j];
+
+    for (unsigned int round=1; round <= 10; ++round) {
+      unsigned char t[16];
+      // SubBytes and ShiftRows
+      for (unsigned int c=0; c < 4; ++c)
+	for (unsigned int r=0; r < 4; ++r)
+	  t[4*c+r] = s[st[4*((c+r)%4)+r]];
+
+      // MixColumns, skipped in the last round
+      if (round < 10) {
+	for (unsigned int c=0; c < 4; ++c) {
+	  unsigned char* col = &t[4*c];
+	  unsigned char a = col[0] ^ col[1] ^ col[2] ^ col[3];
+	  unsigned char c0 = col[0];
+	  col[0] ^= a ^ xtime(col[0] ^ col[1]);
+	  col[1] ^= a ^ xtime(col[1] ^ col[2]);
+	  col[2] ^= a ^ xtime(col[2] ^ col[3]);
+	  col[3] ^= a ^ xtime(col[3] ^ c0);
+	}
+      }
+
+      for (unsigned int j=0; j < 16; ++j)
+	st[j] = t[j] ^ roundkeys[16*round+j];
+    }
+  }
+
+  void counter_block(unsigned long c, unsigned char* block) const {
+    for (unsigned int i=0; i < 8; ++i) {
+      block[i] = (unsigned char)(c >> (8*i));
+      block[8+i] = (unsigned char)(stream >> (8*i));
+    }
+  }
+
+#ifdef SP_HAVE_AESNI
+  __attribute__((target("aes,sse2")))
+  void refill_aesni() {
+    __m128i rk[11];
+    for (unsigned int r=0; r < 11; ++r)
+      rk[r] = _mm_loadu_si128((const __m128i*)&roundkeys[16*r]);
+
+    __m128i* out = (__m128i*)words;
+    for (unsigned int b=0; b < SP_AES_BUFFER_BLOCKS; b += 8) {
+      __m128i x[8];
+      for (unsigned int i=0; i < 8; ++i)
+	x[i] = _mm_xor_si128(_mm_set_epi64x((long long)stream, 
+					    (long long)(counter+i)), rk[0]);
+      for (unsigned int r=1; r < 10; ++r)
+	for (unsigned int i=0; i < 8; ++i)
+	  x[i] = _mm_aesenc_si128(x[i], rk[r]);
+      for (unsigned int i=0; i < 8; ++i)
+	_mm_storeu_si128(&out[b+i], _mm_aesenclast_si128(x[i], rk[10]));
+      counter += 8;
+    }
+  }
+#endif
+
+  void refill() {
+#ifdef SP_HAVE_AESNI
+    if (aesni) {
+      refill_aesni();
+      next = 0;
+      return;
+    }
+#endif
+    unsigned char* out = (unsigned char*)words;
+    for (unsigned int b=0; b < SP_AES_BUFFER_BLOCKS; ++b) {
+      counter_block(counter++, &out[16*b]);
+      encrypt_soft(&out[16*b]);
+    }
+    next = 0;
+  }
+};
+
+#endif
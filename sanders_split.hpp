@@ -0,0 +1,416 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Random split of the numbers 0..n-1 into K groups of exact sizes 
+   (e.g. K-fold cross validation or train/validation/test sets).
+
+   The per-rank group counts are drawn from a multivariate hypergeometric
+   distribution on a stream all ranks share, so every rank knows them
+   without communication and labels its own input block locally. The
+   labelled elements then go through the Sanders phases once: all groups
+   share the phase 1 exchange, are shuffled separately in phase 2 and are
+   placed into balanced per-group output blocks in phase 3.
+*/
+
+#ifndef SANDERS_SPLIT_HPP
+#define SANDERS_SPLIT_HPP
+
+#include <iostream>
+
+#include "sanders_perm.hpp"
+#include "hypergeometric.hpp"
+#include "perm_exchange.hpp"
+
+// rng_t - random number policy, see sanders_rng.hpp
+template<typename perm_t, typename rng_t = sp_mt19937_rng>
+class sanders_split {
+
+  typedef std::vector<perm_t> permute_vector_t;
+
+public:
+  // n - number of elements to split
+  // g - random number generator
+  sanders_split(perm_t& pn, const rng_t& g = rng_t()):n(pn), 
+	gen(g),
+	seed_value(SP_DEFAULT_SEED),
+	waits(NULL) {}
+
+  // seed for the next calls to split; rank r draws from stream r
+  void set_seed(unsigned long s) {
+    seed_value = s;
+  }
+
+  // w - records entry and exit of every collective of the next calls to
+  //     split, NULL for none; must be set on all ranks or on none, see
+  //     perm_wait_profile.hpp
+  void set_wait_profile(sp_wait_profile* w) {
+    waits = w;
+  }
+
+  //  N - total number of processors
+  //  sizes - requested size of every group, must add up to n
+  //  membership - group of every element in this rank's input block
+  //  groups - this rank's output block of every group's shuffled elements
+  void split(int N, const permute_vector_t& sizes,
+	     std::vector<unsigned int>& membership,
+	     std::vector<permute_vector_t>& groups);
+
+private:
+  perm_t& n;
+  int rank;
+  rng_t gen;
+  unsigned long seed_value;
+  sp_wait_profile* waits;
+
+  void error(std::string mpifn, std::string desc) {
+    sp_error("Splitting numbers", mpifn, desc);
+  }
+
+  void assign_groups(unsigned int N, unsigned int count, unsigned int m,
+		     const permute_vector_t& sizes,
+		     std::vector<unsigned int>& membership);
+  void run_phase1(unsigned int count, perm_t pos, unsigned int N,
+		  unsigned int K, 
+		  const std::vector<unsigned int>& membership,
+		  permute_vector_t& temp,
+		  std::vector<perm_t>& gsizes);
+  void run_phase2(permute_vector_t& temp, 
+		  const std::vector<perm_t>& gsizes);
+  void run_phase3(const permute_vector_t& temp, 
+		  const std::vector<perm_t>& gsizes,
+		  unsigned int N,
+		  const permute_vector_t& sizes,
+		  std::vector<permute_vector_t>& groups);
+};
+
+
+#define SANDERS_SPLIT_PARAMS \
+  typename perm_t, typename rng_t
+
+#define SANDERS_SPLIT_TYPE \
+  sanders_split<perm_t, rng_t>
+
+template<SANDERS_SPLIT_PARAMS>
+void 
+SANDERS_SPLIT_TYPE::split(int N, const permute_vector_t& sizes,
+			  std::vector<unsigned int>& membership,
+			  std::vector<permute_vector_t>& groups) {
+
+  if (MPI_Comm_rank(MPI_COMM_WORLD, &rank) != 0)
+    error("MPI_Comm_rank", "Error getting the rank");
+
+  if (sizes.empty()) {
+    error("-", "No groups requested");
+    return;
+  }
+
+  perm_t total = 0;
+  for (unsigned int f=0; f < sizes.size(); ++f)
+    total += sizes[f];
+
+  if (total != n) {
+    error("-", "Group sizes do not add up to n");
+    return;
+  }
+
+  // same block layout as sanders_permutation
+  double j = (double)n/(double)N;
+  unsigned int m = std::ceil(j);
+  perm_t pos = rank * (perm_t)m;
+  unsigned int count = m;
+
+  if (((rank+1)*m) > n)
+    count = (n-pos);
+
+  if (pos >= n)
+    count = 0;
+
+  // leaves gen on this rank's stream for the phases
+  assign_groups(N, count, m, sizes, membership);
+
+  permute_vector_t temp;
+  std::vector<perm_t> gsizes;
+  run_phase1(count, pos, N, sizes.size(), membership, temp, gsizes);
+  run_phase2(temp, gsizes);
+  run_phase3(temp, gsizes, N, sizes, groups);
+}
+
+
+// Draws how many elements of every rank's block go to each group and
+// labels the local block accordingly. All ranks make the same draws from
+// the shared stream and keep their own counts.
+template<SANDERS_SPLIT_PARAMS>
+void 
+SANDERS_SPLIT_TYPE::assign_groups(unsigned int N, unsigned int count, 
+				  unsigned int m,
+				  const permute_vector_t& sizes,
+				  std::vector<unsigned int>& membership) {
+  unsigned int K = sizes.size();
+  std::vector<perm_t> localcounts(K, 0);
+
+  std::vector<perm_t> caps(N, 0);
+  for (unsigned int r=0; r < N; ++r) {
+    perm_t rpos = r * (perm_t)m;
+    if (rpos < n)
+      caps[r] = std::min((perm_t)m, n - rpos);
+  }
+
+  gen.seed(seed_value, SP_SPLIT_STREAMS);
+  std::vector<perm_t> drawn;
+  for (unsigned int f=0; f < K; ++f) {
+    multivariate_hypergeometric(gen, caps, sizes[f], drawn);
+    localcounts[f] = drawn[rank];
+    for (unsigned int r=0; r < N; ++r)
+      caps[r] -= drawn[r];
+  }
+
+  // the labels are shuffled on this rank's own stream
+  gen.seed(seed_value, rank);
+  membership.resize(count);
+  unsigned int k = 0;
+  for (unsigned int f=0; f < K; ++f) {
+    for (perm_t c=0; c < localcounts[f]; ++c)
+      membership[k++] = f;
+  }
+
+  if (count > 1) {
+    for (unsigned int i=(count-1); i >= 1; --i) {
+      boost::random::uniform_int_distribution<unsigned int> dist(0, i);
+      std::swap(membership[i], membership[dist(gen)]);
+    }
+  }
+}
+
+
+// Sends every element to a random rank. Elements are ordered by
+// destination and then by group so that a single Alltoallv moves all
+// groups; gsizes returns how many elements of each group arrived.
+template<SANDERS_SPLIT_PARAMS>
+void 
+SANDERS_SPLIT_TYPE::run_phase1(unsigned int count, perm_t pos, 
+			       unsigned int N, unsigned int K,
+			       const std::vector<unsigned int>& membership,
+			       permute_vector_t& temp,
+			       std::vector<perm_t>& gsizes) {
+
+  boost::random::uniform_int_distribution<> dist(0, (N-1));
+  std::vector<unsigned int> keys(count+1);
+  permute_vector_t elems(count+1);
+
+  for (unsigned int k=0; k < count; ++k) {
+    keys[k] = dist(gen)*K + membership[k];
+    elems[k] = pos+(perm_t)k;
+  }
+
+  // counting sort by (destination, group)
+  std::vector<int> keycnts, keyoffs;
+  permute_vector_t sendbuf(count+1);
+  sp_bucket_by_dest(&elems[0], &keys[0], count, N*K, &sendbuf[0], 
+		    keycnts, keyoffs);
+
+  std::vector<int> recvkeycnts(N*K, 0);
+  if (waits)
+    waits->enter(SP_PHASE_1, "MPI_Alltoall");
+  if (MPI_Alltoall(&keycnts[0], K, MPI_INT,
+		   &recvkeycnts[0], K, MPI_INT, MPI_COMM_WORLD) != 0)
+    error("MPI_Alltoall", "Error exchanging group counts in phase 1");
+  if (waits)
+    waits->exit();
+
+  std::vector<int> sendcnts(N, 0), recvcnts(N, 0);
+  std::vector<int> sdispls(N, 0), rdispls(N, 0);
+  for (unsigned int rp=0; rp < N; ++rp) {
+    for (unsigned int f=0; f < K; ++f) {
+      sendcnts[rp] += keycnts[rp*K+f];
+      recvcnts[rp] += recvkeycnts[rp*K+f];
+    }
+
+    if (rp > 0) {
+      sdispls[rp] = sdispls[rp-1] + sendcnts[rp-1];
+      rdispls[rp] = rdispls[rp-1] + recvcnts[rp-1];
+    }
+  }
+
+  unsigned int total = rdispls[N-1] + recvcnts[N-1];
+  permute_vector_t recvbuf(total+1);
+
+  if (waits)
+    waits->enter(SP_PHASE_1, "MPI_Alltoallv");
+  if (MPI_Alltoallv(&sendbuf[0], &sendcnts[0], &sdispls[0], SP_DATA_TYPE,
+		    &recvbuf[0], &recvcnts[0], &rdispls[0], SP_DATA_TYPE,
+		    MPI_COMM_WORLD) != 0)
+    error("MPI_Alltoallv", "Error exchanging labelled values in phase 1");
+  if (waits)
+    waits->exit();
+
+  // every source sent its elements grouped; regroup them by group only
+  gsizes.assign(K, 0);
+  for (unsigned int q=0; q < N*K; ++q)
+    gsizes[q % K] += recvkeycnts[q];
+
+  std::vector<perm_t> goffs(K, 0);
+  for (unsigned int f=1; f < K; ++f)
+    goffs[f] = goffs[f-1] + gsizes[f-1];
+
+  temp.resize(total);
+  unsigned int src = 0;
+  for (unsigned int q=0; q < N*K; ++q) {
+    unsigned int f = q % K;
+    for (int c=0; c < recvkeycnts[q]; ++c)
+      temp[goffs[f]++] = recvbuf[src++];
+  }
+}
+
+
+// Shuffles the elements of every group separately.
+template<SANDERS_SPLIT_PARAMS>
+void 
+SANDERS_SPLIT_TYPE::run_phase2(permute_vector_t& temp,
+			       const std::vector<perm_t>& gsizes) {
+  perm_t base = 0;
+  for (unsigned int f=0; f < gsizes.size(); ++f) {
+    for (perm_t k=gsizes[f]; k > 1; --k) {
+      boost::random::uniform_int_distribution<perm_t> dist(0, k-1);
+      std::swap(temp[base+k-1], temp[base+dist(gen)]);
+    }
+
+    base += gsizes[f];
+  }
+}
+
+
+// Moves every group to balanced output blocks. This is phase 3 of the
+// permutation run once per group, with the group id in the header.
+template<SANDERS_SPLIT_PARAMS>
+void 
+SANDERS_SPLIT_TYPE::run_phase3(const permute_vector_t& temp,
+			       const std::vector<perm_t>& gsizes,
+			       unsigned int N,
+			       const permute_vector_t& sizes,
+			       std::vector<permute_vector_t>& groups) {
+  unsigned int K = sizes.size();
+  std::vector<perm_t> firsts(K, 0);
+
+  if (waits)
+    waits->enter(SP_PHASE_3, "MPI_Scan");
+  if (MPI_Scan(const_cast<perm_t*>(&gsizes[0]), &firsts[0], K,
+	       SP_DATA_TYPE, MPI_SUM, MPI_COMM_WORLD) != 0)
+    error("MPI_Scan", "Error getting group prefix sums in phase 3");
+  if (waits)
+    waits->exit();
+
+  groups.resize(K);
+  std::vector<perm_t> ms(K, 0), gpos(K, 0);
+  perm_t remains = 0;
+  for (unsigned int f=0; f < K; ++f) {
+    firsts[f] -= gsizes[f];
+    ms[f] = (sizes[f] + N - 1) / N;
+    gpos[f] = rank * ms[f];
+
+    perm_t gcount = 0;
+    if (gpos[f] < sizes[f])
+      gcount = std::min(ms[f], sizes[f] - gpos[f]);
+
+    groups[f].resize(gcount);
+    remains += gcount;
+  }
+
+  // one header (group, first, count) per outgoing range; all headers are
+  // built before sending so that they stay in place until MPI_Wait
+  std::vector<perm_t> headers;
+  std::vector<unsigned int> dests;
+  std::vector<const perm_t*> srcs;
+
+  perm_t base = 0;
+  for (unsigned int f=0; f < K; ++f) {
+    perm_t firstp = firsts[f];
+    perm_t end = firsts[f] + gsizes[f];
+
+    while (firstp < end) {
+      unsigned int rp = firstp / ms[f];
+      perm_t lastp = std::min((rp+1)*ms[f], end);
+      perm_t countp = lastp - firstp;
+      const perm_t* src = &temp[base + (firstp - firsts[f])];
+
+      if (rank == (int)rp) {
+	std::copy(src, src+countp, &groups[f][firstp - gpos[f]]);
+	remains -= countp;
+      } else {
+	headers.push_back(f);
+	headers.push_back(firstp);
+	headers.push_back(countp);
+	dests.push_back(rp);
+	srcs.push_back(src);
+      }
+
+      firstp = lastp;
+    }
+
+    base += gsizes[f];
+  }
+
+  std::vector<MPI_Request> requests(2*dests.size());
+  for (unsigned int k=0; k < dests.size(); ++k) {
+    if (MPI_Isend(&headers[3*k], 3, SP_DATA_TYPE, dests[k], 1,
+		  MPI_COMM_WORLD, &requests[2*k]) != 0)
+      error("MPI_Isend", "Error sending group ranges in phase 3");
+
+    if (MPI_Isend(const_cast<perm_t*>(srcs[k]), headers[3*k+2], SP_DATA_TYPE,
+		  dests[k], 2, MPI_COMM_WORLD, &requests[2*k+1]) != 0)
+      error("MPI_Isend", "Error sending group elements in phase 3");
+  }
+
+  perm_t buf[3];
+  while (remains > 0) {
+    MPI_Status status;
+    if (MPI_Recv(buf, 3, SP_DATA_TYPE, MPI_ANY_SOURCE, 1,
+		 MPI_COMM_WORLD, &status) != 0)
+      error("MPI_Recv", "Error while receiving group ranges in phase 3");
+
+    unsigned int f = buf[0];
+    if (MPI_Recv(&groups[f][buf[1] - gpos[f]], buf[2], SP_DATA_TYPE,
+		 status.MPI_SOURCE, 2, MPI_COMM_WORLD, &status) != 0)
+      error("MPI_Recv", "Error while receiving group elements in phase 3");
+
+    remains -= buf[2];
+  }
+
+  for (unsigned int k=0; k < requests.size(); ++k) {
+    if (MPI_Wait(&requests[k], MPI_STATUS_IGNORE) != 0)
+      error("MPI_Wait", "Error waiting for requests in phase 3");
+  }
+
+  if (waits)
+    waits->enter(SP_PHASE_3, "MPI_Barrier");
+  if (MPI_Barrier(MPI_COMM_WORLD) != 0)
+    error("MPI_Barrier", "Error invoking barrier in phase 3");
+  if (waits)
+    waits->exit();
+}
+
+#endif
@@ -0,0 +1,240 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Batches of many independent permutations of a small n.
+
+   The permutations are numbered; permutation i is determined by the seed
+   and i alone, whichever rank or thread generates it. They are generated
+   in chunks of SP_SMALL_PERM_CHUNK, chunk c drawing from stream c of the
+   SP_SMALL_PERM_STREAMS streams, and chunks are handed out to the threads
+   dynamically.
+
+   Within a chunk, SP_SMALL_PERM_LANES permutations are shuffled together
+   by Fisher-Yates with their elements interleaved (element k of lane l at
+   k*LANES + l): every step draws one index per lane and swaps within each
+   lane, so the lanes are independent dependency chains the compiler can 
+   vectorize and the processor can overlap. Indexes are drawn by
+   multiply-shift with rejection of the few biased values (Lemire).
+
+   generate calls visitor(index, perms, count) with count permutations in
+   rows of n values, the first being permutation index. The visitor is 
+   called concurrently from all threads.
+*/
+
+#ifndef SANDERS_SMALL_PERM_HPP
+#define SANDERS_SMALL_PERM_HPP
+
+#include <mpi.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "sanders_rng.hpp"
+
+#define SP_SMALL_PERM_LANES 8
+// permutations per chunk, a multiple of SP_SMALL_PERM_LANES
+#define SP_SMALL_PERM_CHUNK 4096
+
+template<typename perm_t = uint16_t, typename rng_t = sp_mt19937_rng>
+class small_permutations {
+public:
+  // n - size of every permutation, at most 2^32 - 1 and representable
+  //     in perm_t
+  small_permutations(unsigned int pn, const rng_t& g = rng_t())
+    : n(pn), gen(g), seed_value(SP_DEFAULT_SEED),
+      nthreads(std::thread::hardware_concurrency()) {
+    if (nthreads == 0)
+      nthreads = 1;
+  }
+
+  void set_seed(unsigned long s) {
+    seed_value = s;
+  }
+
+  void set_threads(unsigned int t) {
+    nthreads = (t > 0) ? t : 1;
+  }
+
+  // Generates permutations [first, first+count) on this rank.
+  template<typename visitor_t>
+  void generate(unsigned long first, unsigned long count, visitor_t& visitor);
+
+  // Generates permutations [0, total), split over the ranks in whole
+  // chunks. No communication.
+  template<typename visitor_t>
+  void generate_distributed(unsigned long total, visitor_t& visitor);
+
+private:
+  unsigned int n;
+  rng_t gen;
+  unsigned long seed_value;
+  unsigned int nthreads;
+
+  // shuffles one group of lanes in the interleaved buffer
+  void shuffle_lanes(rng_t& g, perm_t* lanes) const;
+
+  // generates the part [first, last) of chunk c
+  template<typename visitor_t>
+  void generate_chunk(rng_t& g, unsigned long c, unsigned long first,
+		      unsigned long last, std::vector<perm_t>& lanes,
+		      std::vector<perm_t>& rows, visitor_t& visitor) const;
+};
+
+
+template<typename perm_t, typename rng_t>
+void 
+small_permutations<perm_t, rng_t>::shuffle_lanes(rng_t& g, 
+						 perm_t* lanes) const {
+  const unsigned int L = SP_SMALL_PERM_LANES;
+  uint32_t draws[L];
+  uint32_t j[L];
+  uint32_t low[L];
+
+  for (unsigned int k=0; k < n; ++k)
+    for (unsigned int l=0; l < L; ++l)
+      lanes[k*L+l] = (perm_t)k;
+
+  for (unsigned int i=n-1; i > 0; --i) {
+    const uint32_t bound = i + 1;
+    for (unsigned int l=0; l < L; ++l)
+      draws[l] = (uint32_t)g();
+
+    unsigned int biased = 0;
+    for (unsigned int l=0; l < L; ++l) {
+      uint64_t m = (uint64_t)draws[l] * bound;
+      j[l] = (uint32_t)(m >> 32);
+      low[l] = (uint32_t)m;
+      biased |= (low[l] < bound);
+    }
+
+    // rare: only when the low half falls below the bound
+    if (biased) {
+      const uint32_t threshold = (0U - bound) % bound;
+      for (unsigned int l=0; l < L; ++l) {
+	while (low[l] < threshold) {
+	  uint64_t m = (uint64_t)(uint32_t)g() * bound;
+	  j[l] = (uint32_t)(m >> 32);
+	  low[l] = (uint32_t)m;
+	}
+      }
+    }
+
+    perm_t* row = &lanes[i*L];
+    for (unsigned int l=0; l < L; ++l) {
+      perm_t t = row[l];
+      row[l] = lanes[j[l]*L+l];
+      lanes[j[l]*L+l] = t;
+    }
+  }
+}
+
+
+template<typename perm_t, typename rng_t>
+template<typename visitor_t>
+void 
+small_permutations<perm_t, rng_t>::generate_chunk(rng_t& g, unsigned long c,
+						  unsigned long first,
+						  unsigned long last,
+						  std::vector<perm_t>& lanes,
+						  std::vector<perm_t>& rows,
+						  visitor_t& visitor) const {
+  const unsigned int L = SP_SMALL_PERM_LANES;
+  unsigned long base = c * SP_SMALL_PERM_CHUNK;
+  g.seed(seed_value, SP_SMALL_PERM_STREAMS | c);
+
+  // groups before first are drawn too, the draws of a chunk are fixed
+  for (unsigned long gb=base; gb < last; gb += L) {
+    shuffle_lanes(g, &lanes[0]);
+    if (gb + L <= first)
+      continue;
+
+    unsigned long from = std::max(gb, first);
+    unsigned long to = std::min(gb + L, last);
+    for (unsigned long p=from; p < to; ++p) {
+      unsigned int l = p - gb;
+      perm_t* row = &rows[(p-from)*n];
+      for (unsigned int k=0; k < n; ++k)
+	row[k] = lanes[k*L+l];
+    }
+    visitor(from, (const perm_t*)&rows[0], (unsigned int)(to - from));
+  }
+}
+
+
+template<typename perm_t, typename rng_t>
+template<typename visitor_t>
+void 
+small_permutations<perm_t, rng_t>::generate(unsigned long first, 
+					    unsigned long count,
+					    visitor_t& visitor) {
+  if ((count == 0) || (n == 0))
+    return;
+
+  unsigned long last = first + count;
+  unsigned long cfirst = first / SP_SMALL_PERM_CHUNK;
+  unsigned long clast = (last - 1) / SP_SMALL_PERM_CHUNK + 1;
+  std::atomic<unsigned long> next(cfirst);
+
+  std::vector<std::thread> threads;
+  for (unsigned int t=0; t < nthreads; ++t) {
+    threads.push_back(std::thread([&]() {
+	  rng_t g(gen);
+	  std::vector<perm_t> lanes((unsigned long)n*SP_SMALL_PERM_LANES);
+	  std::vector<perm_t> rows((unsigned long)n*SP_SMALL_PERM_LANES);
+	  for (unsigned long c = next++; c < clast; c = next++)
+	    generate_chunk(g, c, std::max(first, c*SP_SMALL_PERM_CHUNK),
+			   std::min(last, (c+1)*SP_SMALL_PERM_CHUNK),
+			   lanes, rows, visitor);
+	}));
+  }
+
+  for (unsigned int t=0; t < nthreads; ++t)
+    threads[t].join();
+}
+
+
+template<typename perm_t, typename rng_t>
+template<typename visitor_t>
+void 
+small_permutations<perm_t, rng_t>::generate_distributed(unsigned long total,
+							visitor_t& visitor) {
+  int N, rank;
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  unsigned long chunks = (total + SP_SMALL_PERM_CHUNK - 1) / SP_SMALL_PERM_CHUNK;
+  unsigned long first = std::min(total, 
+				 chunks * rank / N * SP_SMALL_PERM_CHUNK);
+  unsigned long last = std::min(total, 
+				chunks * (rank+1) / N * SP_SMALL_PERM_CHUNK);
+  generate(first, last - first, visitor);
+}
+
+#endif
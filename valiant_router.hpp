@@ -0,0 +1,124 @@
+// Copyright (C) 2018 Thejaka Amila Kanewala
+
+// Boost Software License - Version 1.0 - August 17th, 2003
+
+// Permission is hereby granted, free of charge, to any person or organization
+// obtaining a copy of the software and accompanying documentation covered by
+// this license (the "Software") to use, reproduce, display, distribute,
+// execute, and transmit the Software, and to prepare derivative works of the
+// Software, and to permit third-parties to whom the Software is furnished to
+// do so, all subject to the following:
+
+// The copyright notices in the Software and this entire statement, including
+// the above license grant, this restriction and the following disclaimer,
+// must be included in all copies of the Software, in whole or in part, and
+// all derivative works of the Software, unless such copies or derivative
+// works are solely in the form of machine-executable object code generated by
+// a source language processor.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE, TITLE AND NON-INFRINGEMENT. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDERS OR ANYONE DISTRIBUTING THE SOFTWARE BE LIABLE
+// FOR ANY DAMAGES OR OTHER LIABILITY, WHETHER IN CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+//  Authors: Thejaka Kanewala
+/**************************************************************************
+   Valiant load balancing for arbitrary all-to-all traffic.
+
+   Phase 1 of the permutation sends every element to a uniformly random
+   rank, which spreads any traffic pattern evenly. The router reuses that
+   to deliver arbitrary (destination, payload) pairs: the first exchange
+   sends every pair to a random intermediate rank, the second forwards it
+   to its destination. Both exchanges have balanced traffic in expectation
+   even when the destinations are skewed, so no single link or rank pair
+   becomes a hotspot; only the final receive volumes stay as requested.
+
+   Payloads must be trivially copyable; they are sent as bytes.
+*/
+
+#ifndef SANDERS_VALIANT_ROUTER_HPP
+#define SANDERS_VALIANT_ROUTER_HPP
+
+#include <mpi.h>
+#include <vector>
+#include <iostream>
+
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include "sanders_rng.hpp"
+#include "perm_exchange.hpp"
+
+template<typename payload_t, typename rng_t = sp_mt19937_rng>
+class valiant_router {
+
+  struct routed {
+    payload_t payload;
+    int dest;
+  };
+
+public:
+  valiant_router(const rng_t& g = rng_t()) : gen(g), 
+					     seed_value(SP_DEFAULT_SEED) {}
+
+  void set_seed(unsigned long s) {
+    seed_value = s;
+  }
+
+  // dests[i] - destination rank of payloads[i]
+  // received - payloads routed to this rank, in no particular order
+  void route(const std::vector<int>& dests, 
+	     const std::vector<payload_t>& payloads,
+	     std::vector<payload_t>& received);
+
+private:
+  rng_t gen;
+  unsigned long seed_value;
+};
+
+
+template<typename payload_t, typename rng_t>
+void
+valiant_router<payload_t, rng_t>::route(const std::vector<int>& dests,
+					const std::vector<payload_t>& payloads,
+					std::vector<payload_t>& received) {
+  int rank, N;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &N);
+  gen.seed(seed_value, rank);
+
+  MPI_Datatype type;
+  MPI_Type_contiguous(sizeof(routed), MPI_BYTE, &type);
+  MPI_Type_commit(&type);
+
+  // first exchange: to random intermediate ranks
+  boost::random::uniform_int_distribution<> dist(0, (N-1));
+  std::vector<routed> items(payloads.size());
+  std::vector<int> hops(payloads.size());
+  for (unsigned int k=0; k < payloads.size(); ++k) {
+    items[k].payload = payloads[k];
+    items[k].dest = dests[k];
+    hops[k] = dist(gen);
+  }
+
+  std::vector<routed> relayed;
+  sp_exchange_by_dest(items, hops, N, type, relayed);
+
+  // second exchange: from the intermediates to the destinations
+  items.clear();
+  hops.resize(relayed.size());
+  for (unsigned int k=0; k < relayed.size(); ++k)
+    hops[k] = relayed[k].dest;
+
+  std::vector<routed> delivered;
+  sp_exchange_by_dest(relayed, hops, N, type, delivered);
+  MPI_Type_free(&type);
+
+  received.resize(delivered.size());
+  for (unsigned int k=0; k < delivered.size(); ++k)
+    received[k] = delivered[k].payload;
+}
+
+#endif